@@ -1,4 +1,8 @@
 #include "Json.h"
+#include "JsonScanner.h"
+
+#include <iterator>
+#include <stdexcept>
 
 using namespace std;
 
@@ -10,83 +14,92 @@ namespace Json {
         return root;
     }
 
-    Node LoadNode(istream& input);
+    namespace {
 
-    Node LoadArray(istream& input) {
-        vector<Node> result;
+        class Parser {
+        public:
+            explicit Parser(string_view text) : scanner_(text) {}
 
-        for (char c; input >> c && c != ']'; ) {
-            if (c != ',') {
-                input.putback(c);
+            Node ParseDocument() {
+                Node root = ParseNode();
+                if (!scanner_.AtEnd()) {
+                    scanner_.Fail("unexpected trailing characters");
+                }
+                return root;
             }
-            result.push_back(LoadNode(input));
-        }
-
-        return Node(move(result));
-    }
-
-    Node LoadNumber(istream& input) {
-        double result;
-        input >> result;
-        return Node(result);
-     }
-
-    Node LoadString(istream& input) {
-        string line;
-        getline(input, line, '"');
-        return Node(move(line));
-    }
 
-    Node LoadBool(istream& input) {
-        string line;
-        char c;
-        for (int i = 0; i < 4; ++i) {
-            input >> c;
-            line.push_back(c);
-        }
-        if(line == "true")
-            return Node(true);
-        input >> c;
-        return Node(false);
-    }
-
-    Node LoadDict(istream& input) {
-        map<string, Node> result;
+        private:
+            Detail::Scanner scanner_;
+            vector<Node> elements_stack_;
+            string decoded_;
+
+            Node ParseNode() {
+                switch (scanner_.Peek()) {
+                case '[':
+                    return ParseArray();
+                case '{':
+                    return ParseDict();
+                case '"':
+                    return Node(string(scanner_.ParseString(decoded_)));
+                case 't':
+                case 'f':
+                    return Node(scanner_.ParseBool());
+                default:
+                    return Node(scanner_.ParseNumber());
+                }
+            }
 
-        for (char c; input >> c && c != '}'; ) {
-            if (c == ',') {
-                input >> c;
+            // Elements are collected on a shared stack first, so every array is
+            // allocated once with its exact size.
+            Node ParseArray() {
+                scanner_.Skip();
+                const size_t first_element = elements_stack_.size();
+                if (scanner_.Peek() == ']') {
+                    scanner_.Skip();
+                    return Node(vector<Node>());
+                }
+                do {
+                    elements_stack_.push_back(ParseNode());
+                } while (!scanner_.NextOrClose(']'));
+                vector<Node> result(
+                    make_move_iterator(elements_stack_.begin() + first_element),
+                    make_move_iterator(elements_stack_.end())
+                );
+                elements_stack_.resize(first_element);
+                return Node(move(result));
             }
 
-            string key = LoadString(input).AsString();
-            input >> c;
-            result.emplace(move(key), LoadNode(input));
-        }
+            Node ParseDict() {
+                scanner_.Skip();
+                map<string, Node> result;
+                if (scanner_.Peek() == '}') {
+                    scanner_.Skip();
+                    return Node(move(result));
+                }
+                do {
+                    if (scanner_.Peek() != '"') {
+                        scanner_.Fail("expected object key");
+                    }
+                    string key(scanner_.ParseString(decoded_));
+                    scanner_.Expect(':');
+                    result.emplace(move(key), ParseNode());
+                } while (!scanner_.NextOrClose('}'));
+                return Node(move(result));
+            }
+        };
 
-        return Node(move(result));
     }
 
-    Node LoadNode(istream& input) {
-        char c;
-        input >> c;
-
-        if (c == '[') {
-            return LoadArray(input);
-        } else if (c == '{') {
-            return LoadDict(input);
-        } else if (c == '"') {
-            return LoadString(input);
-        } else if (c == 't' || c == 'f') {
-            input.putback(c);
-            return LoadBool(input);
-        } else {
-            input.putback(c);
-            return LoadNumber(input);
-        }
+    Document Load(string_view text) {
+        return Document{Parser(text).ParseDocument()};
     }
 
     Document Load(istream& input) {
-        return Document{LoadNode(input)};
+        return Load(Detail::ReadStream(input).GetText());
+    }
+
+    Document LoadFile(const string& path) {
+        return Load(Detail::ReadFile(path).GetText());
     }
 
 }
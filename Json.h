@@ -3,6 +3,7 @@
 #include <istream>
 #include <map>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -43,6 +44,10 @@ namespace Json {
             Node root;  
     };
 
+    // Reads the whole stream into memory and parses it in one pass.
     Document Load(std::istream& input);
+    Document Load(std::string_view text);
+    // Parses a file mapped into memory.
+    Document LoadFile(const std::string& path);
 
 }
@@ -0,0 +1,253 @@
+#pragma once
+
+#include "input_buffer.h"
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Low-level tokenizer shared by the JSON document models; not part of the public API.
+namespace Json::Detail {
+
+    // Documents keep their input alive for as long as they refer to it.
+    using InputBuffer = Input::Buffer;
+    using Input::ReadStream;
+    using Input::ReadFile;
+
+    struct WhitespaceTable {
+        bool is_space[256] = {};
+
+        constexpr WhitespaceTable() {
+            is_space[static_cast<unsigned char>(' ')] = true;
+            is_space[static_cast<unsigned char>('\t')] = true;
+            is_space[static_cast<unsigned char>('\n')] = true;
+            is_space[static_cast<unsigned char>('\r')] = true;
+        }
+    };
+
+    inline constexpr WhitespaceTable WHITESPACE;
+
+    // Scans a contiguous buffer: no stream state, no putback, strings are found
+    // with memchr and numbers read with from_chars.
+    class Scanner {
+    public:
+        explicit Scanner(std::string_view text) : pos_(text.data()), end_(text.data() + text.size()) {}
+
+        [[noreturn]] void Fail(const char* message) const {
+            throw std::invalid_argument(std::string("JSON parse error: ") + message);
+        }
+
+        bool AtEnd() {
+            SkipWhitespace();
+            return pos_ == end_;
+        }
+
+        char Peek() {
+            SkipWhitespace();
+            if (pos_ == end_) {
+                Fail("unexpected end of input");
+            }
+            return *pos_;
+        }
+
+        void Skip() {
+            ++pos_;
+        }
+
+        void Expect(char c) {
+            if (Peek() != c) {
+                Fail("unexpected character");
+            }
+            ++pos_;
+        }
+
+        // Consumes ',' and returns false, or consumes closing and returns true.
+        bool NextOrClose(char closing) {
+            const char c = Peek();
+            ++pos_;
+            if (c == closing) {
+                return true;
+            }
+            if (c != ',') {
+                Fail("expected ',' or closing bracket");
+            }
+            return false;
+        }
+
+        bool ParseBool() {
+            if (*pos_ == 't') {
+                ParseLiteral("true");
+                return true;
+            }
+            ParseLiteral("false");
+            return false;
+        }
+
+        double ParseNumber() {
+            double result = 0;
+            const auto [ptr, ec] = std::from_chars(pos_, end_, result);
+            if (ec != std::errc() || ptr == pos_) {
+                Fail("invalid number");
+            }
+            pos_ = ptr;
+            return result;
+        }
+
+        // Expects the opening quote. Returns a view into the input when the
+        // string has no escapes, otherwise decodes it into decoded and returns
+        // a view of that.
+        std::string_view ParseString(std::string& decoded) {
+            ++pos_;
+            const char* begin = pos_;
+            const char* quote = FindQuote();
+            const char* backslash = static_cast<const char*>(std::memchr(pos_, '\\', quote - pos_));
+            if (!backslash) {
+                pos_ = quote + 1;
+                return {begin, static_cast<size_t>(quote - begin)};
+            }
+            decoded.clear();
+            while (true) {
+                if (!backslash) {
+                    decoded.append(pos_, quote);
+                    pos_ = quote + 1;
+                    return decoded;
+                }
+                decoded.append(pos_, backslash);
+                pos_ = backslash + 1;
+                ParseEscape(decoded);
+                quote = FindQuote();
+                backslash = static_cast<const char*>(std::memchr(pos_, '\\', quote - pos_));
+            }
+        }
+
+        // Skips one complete value without building anything.
+        void SkipValue() {
+            std::string decoded;
+            switch (Peek()) {
+            case '[':
+            case '{': {
+                const char closing = *pos_ == '[' ? ']' : '}';
+                ++pos_;
+                if (Peek() == closing) {
+                    ++pos_;
+                    return;
+                }
+                do {
+                    if (closing == '}') {
+                        if (Peek() != '"') {
+                            Fail("expected object key");
+                        }
+                        ParseString(decoded);
+                        Expect(':');
+                    }
+                    SkipValue();
+                } while (!NextOrClose(closing));
+                return;
+            }
+            case '"':
+                ParseString(decoded);
+                return;
+            case 't':
+            case 'f':
+                ParseBool();
+                return;
+            default:
+                ParseNumber();
+            }
+        }
+
+    private:
+        const char* pos_;
+        const char* end_;
+
+        void SkipWhitespace() {
+            while (pos_ != end_ && WHITESPACE.is_space[static_cast<unsigned char>(*pos_)]) {
+                ++pos_;
+            }
+        }
+
+        void ParseLiteral(std::string_view literal) {
+            if (static_cast<size_t>(end_ - pos_) < literal.size() || std::string_view(pos_, literal.size()) != literal) {
+                Fail("invalid literal");
+            }
+            pos_ += literal.size();
+        }
+
+        const char* FindQuote() const {
+            const char* quote = static_cast<const char*>(std::memchr(pos_, '"', end_ - pos_));
+            if (!quote) {
+                Fail("unterminated string");
+            }
+            return quote;
+        }
+
+        uint32_t ParseHex4() {
+            if (end_ - pos_ < 4) {
+                Fail("truncated \\u escape");
+            }
+            uint32_t code = 0;
+            const auto [ptr, ec] = std::from_chars(pos_, pos_ + 4, code, 16);
+            if (ec != std::errc() || ptr != pos_ + 4) {
+                Fail("invalid \\u escape");
+            }
+            pos_ += 4;
+            return code;
+        }
+
+        static void AppendUtf8(std::string& out, uint32_t code) {
+            if (code < 0x80) {
+                out.push_back(static_cast<char>(code));
+            } else if (code < 0x800) {
+                out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+                out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+            } else if (code < 0x10000) {
+                out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+                out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+            } else {
+                out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+                out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+            }
+        }
+
+        void ParseEscape(std::string& out) {
+            if (pos_ == end_) {
+                Fail("truncated escape");
+            }
+            const char c = *pos_++;
+            switch (c) {
+            case '"': out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/': out.push_back('/'); break;
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u': {
+                uint32_t code = ParseHex4();
+                if (code >= 0xD800 && code < 0xDC00 && end_ - pos_ >= 6 && pos_[0] == '\\' && pos_[1] == 'u') {
+                    pos_ += 2;
+                    const uint32_t low = ParseHex4();
+                    if (low < 0xDC00 || low >= 0xE000) {
+                        Fail("invalid surrogate pair");
+                    }
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                AppendUtf8(out, code);
+                break;
+            }
+            default:
+                Fail("invalid escape");
+            }
+        }
+    };
+
+}
@@ -0,0 +1,205 @@
+#include "JsonView.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Json::View {
+
+    const Node& Array::at(size_t idx) const {
+        if (idx >= size_) {
+            throw out_of_range("array index " + to_string(idx) + " is out of range");
+        }
+        return begin_[idx];
+    }
+
+    const Member* Object::find(string_view key) const {
+        const Member* it = lower_bound(begin(), end(), key, [](const Member& member, string_view key) {
+            return member.first < key;
+        });
+        return it != end() && it->first == key ? it : end();
+    }
+
+    const Node& Object::at(string_view key) const {
+        const Member* it = find(key);
+        if (it == end()) {
+            throw out_of_range("key " + string(key) + " is not found");
+        }
+        return it->second;
+    }
+
+    void* Arena::Allocate(size_t size, size_t alignment) {
+        size_t offset = (used_ + alignment - 1) & ~(alignment - 1);
+        if (blocks_.empty() || offset + size > block_size_) {
+            block_size_ = max(next_block_size_, size + alignment);
+            next_block_size_ = min(block_size_ * 2, MAX_BLOCK_SIZE);
+            blocks_.push_back(unique_ptr<char[]>(new char[block_size_]));
+            used_ = 0;
+            const auto address = reinterpret_cast<uintptr_t>(blocks_.back().get());
+            offset = ((address + alignment - 1) & ~(alignment - 1)) - address;
+        }
+        used_ = offset + size;
+        return blocks_.back().get() + offset;
+    }
+
+    void Arena::Reset() {
+        if (blocks_.size() > 1) {
+            blocks_.erase(blocks_.begin(), blocks_.end() - 1);
+        }
+        used_ = 0;
+    }
+
+    Node Builder::ParseNode() {
+        switch (scanner_.Peek()) {
+        case '[':
+            return ParseArray();
+        case '{':
+            return ParseObject();
+        case '"':
+            return Node(ParseString());
+        case 't':
+        case 'f':
+            return Node(scanner_.ParseBool());
+        default:
+            return Node(scanner_.ParseNumber());
+        }
+    }
+
+    string_view Builder::ParseString() {
+        const string_view value = scanner_.ParseString(decoded_);
+        if (value.data() != decoded_.data()) {
+            return value;
+        }
+        char* chars = arena_.Allocate<char>(value.size());
+        memcpy(chars, value.data(), value.size());
+        return {chars, value.size()};
+    }
+
+    Node Builder::ParseArray() {
+        scanner_.Skip();
+        const size_t first_element = elements_stack_.size();
+        if (scanner_.Peek() == ']') {
+            scanner_.Skip();
+            return Node(static_cast<const Node*>(nullptr), 0);
+        }
+        do {
+            elements_stack_.push_back(ParseNode());
+        } while (!scanner_.NextOrClose(']'));
+        const size_t size = elements_stack_.size() - first_element;
+        Node* items = arena_.Allocate<Node>(size);
+        copy(elements_stack_.begin() + first_element, elements_stack_.end(), items);
+        elements_stack_.resize(first_element);
+        return Node(static_cast<const Node*>(items), size);
+    }
+
+    Node Builder::ParseObject() {
+        scanner_.Skip();
+        const size_t first_member = members_stack_.size();
+        if (scanner_.Peek() == '}') {
+            scanner_.Skip();
+            return Node(static_cast<const Member*>(nullptr), 0);
+        }
+        do {
+            if (scanner_.Peek() != '"') {
+                scanner_.Fail("expected object key");
+            }
+            const string_view key = ParseString();
+            scanner_.Expect(':');
+            const Node value = ParseNode();
+            members_stack_.push_back({key, value});
+        } while (!scanner_.NextOrClose('}'));
+
+        const auto first = members_stack_.begin() + first_member;
+        const auto by_key = [](const Member& lhs, const Member& rhs) {
+            return lhs.first < rhs.first;
+        };
+        if (!is_sorted(first, members_stack_.end(), by_key)) {
+            stable_sort(first, members_stack_.end(), by_key);
+        }
+        // The first of duplicate keys wins, as with std::map::emplace.
+        const auto last = unique(first, members_stack_.end(), [](const Member& lhs, const Member& rhs) {
+            return lhs.first == rhs.first;
+        });
+        const size_t size = last - first;
+        Member* members = arena_.Allocate<Member>(size);
+        copy(first, last, members);
+        members_stack_.resize(first_member);
+        return Node(static_cast<const Member*>(members), size);
+    }
+
+    Document::Document(Detail::InputBuffer input)
+        : input_(move(input))
+    {
+        Detail::Scanner scanner(input_.GetText());
+        root_ = Builder(scanner, arena_).ParseNode();
+        if (!scanner.AtEnd()) {
+            scanner.Fail("unexpected trailing characters");
+        }
+    }
+
+    StreamReader::StreamReader(Detail::InputBuffer input)
+        : input_(move(input)),
+        scanner_(input_.GetText())
+    {
+    }
+
+    void StreamReader::ReadRootObject(const function<void(string_view key)>& on_member) {
+        scanner_.Expect('{');
+        if (scanner_.Peek() == '}') {
+            scanner_.Skip();
+        }
+        else {
+            do {
+                if (scanner_.Peek() != '"') {
+                    scanner_.Fail("expected object key");
+                }
+                const string key(scanner_.ParseString(decoded_));
+                scanner_.Expect(':');
+                on_member(key);
+            } while (!scanner_.NextOrClose('}'));
+        }
+        if (!scanner_.AtEnd()) {
+            scanner_.Fail("unexpected trailing characters");
+        }
+    }
+
+    const Node& StreamReader::ReadValue() {
+        values_.push_back(make_unique<Node>(Builder(scanner_, values_arena_).ParseNode()));
+        return *values_.back();
+    }
+
+    void StreamReader::ReadArray(const function<void(const Node& element)>& on_element) {
+        scanner_.Expect('[');
+        if (scanner_.Peek() == ']') {
+            scanner_.Skip();
+            return;
+        }
+        Builder builder(scanner_, element_arena_);
+        do {
+            element_arena_.Reset();
+            on_element(builder.ParseNode());
+        } while (!scanner_.NextOrClose(']'));
+    }
+
+    void StreamReader::SkipValue() {
+        scanner_.SkipValue();
+    }
+
+    Document Load(istream& input) {
+        return Document(Detail::ReadStream(input));
+    }
+
+    Document Load(string text) {
+        auto buffer = make_shared<string>(move(text));
+        const size_t size = buffer->size();
+        const char* data = buffer->data();
+        return Document({shared_ptr<const char>(move(buffer), data), size});
+    }
+
+    Document LoadFile(const string& path) {
+        return Document(Detail::ReadFile(path));
+    }
+
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include "JsonScanner.h"
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+// Read-only JSON document whose nodes live in a monotonic arena. Strings are
+// views into the input buffer and are copied into the arena only when they
+// contain escapes; objects are flat arrays of members sorted by key.
+namespace Json::View {
+
+    class Node;
+    struct Member;
+
+    class Array {
+    public:
+        Array(const Node* begin, size_t size) : begin_(begin), size_(size) {}
+
+        const Node* begin() const { return begin_; }
+        const Node* end() const;
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+        const Node& operator[](size_t idx) const;
+        const Node& at(size_t idx) const;
+        const Node& front() const;
+        const Node& back() const;
+
+    private:
+        const Node* begin_;
+        size_t size_;
+    };
+
+    class Object {
+    public:
+        Object(const Member* begin, size_t size) : begin_(begin), size_(size) {}
+
+        const Member* begin() const { return begin_; }
+        const Member* end() const;
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+        const Member* find(std::string_view key) const;
+        size_t count(std::string_view key) const { return find(key) != end(); }
+        const Node& at(std::string_view key) const;
+
+    private:
+        const Member* begin_;
+        size_t size_;
+    };
+
+    class Node {
+    public:
+        enum class Type : uint8_t {
+            ARRAY,
+            OBJECT,
+            BOOL,
+            NUMBER,
+            STRING,
+        };
+
+        Node() : type_(Type::BOOL), size_(0), boolean_(false) {}
+        explicit Node(bool value) : type_(Type::BOOL), size_(0), boolean_(value) {}
+        explicit Node(double value) : type_(Type::NUMBER), size_(0), number_(value) {}
+        explicit Node(std::string_view value) : type_(Type::STRING), size_(CheckSize(value.size())), chars_(value.data()) {}
+        Node(const Node* items, size_t size) : type_(Type::ARRAY), size_(CheckSize(size)), items_(items) {}
+        Node(const Member* members, size_t size) : type_(Type::OBJECT), size_(CheckSize(size)), members_(members) {}
+
+        Type GetType() const { return type_; }
+        bool IsArray() const { return type_ == Type::ARRAY; }
+        bool IsMap() const { return type_ == Type::OBJECT; }
+        bool IsBool() const { return type_ == Type::BOOL; }
+        bool IsNumber() const { return type_ == Type::NUMBER; }
+        bool IsString() const { return type_ == Type::STRING; }
+
+        // Like Json::Node, asking for the wrong type throws std::bad_variant_access.
+        Array AsArray() const {
+            Check(Type::ARRAY);
+            return {items_, size_};
+        }
+        Object AsMap() const {
+            Check(Type::OBJECT);
+            return {members_, size_};
+        }
+        double AsNumber() const {
+            Check(Type::NUMBER);
+            return number_;
+        }
+        std::string_view AsString() const {
+            Check(Type::STRING);
+            return {chars_, size_};
+        }
+        bool AsBool() const {
+            Check(Type::BOOL);
+            return boolean_;
+        }
+
+    private:
+        Type type_;
+        uint32_t size_;
+        union {
+            bool boolean_;
+            double number_;
+            const char* chars_;
+            const Node* items_;
+            const Member* members_;
+        };
+
+        void Check(Type type) const {
+            if (type_ != type) {
+                throw std::bad_variant_access();
+            }
+        }
+
+        // Sizes are stored in 32 bits to keep nodes at 16 bytes.
+        static uint32_t CheckSize(size_t size) {
+            if (size > std::numeric_limits<uint32_t>::max()) {
+                throw std::length_error("JSON value has too many elements");
+            }
+            return static_cast<uint32_t>(size);
+        }
+    };
+
+    // Named like std::map entries so that both object models iterate alike.
+    struct Member {
+        std::string_view first;
+        Node second;
+    };
+
+    inline const Node* Array::end() const {
+        return begin_ + size_;
+    }
+
+    inline const Node& Array::operator[](size_t idx) const {
+        return begin_[idx];
+    }
+
+    inline const Node& Array::front() const {
+        return begin_[0];
+    }
+
+    inline const Node& Array::back() const {
+        return begin_[size_ - 1];
+    }
+
+    inline const Member* Object::end() const {
+        return begin_ + size_;
+    }
+
+    // Bump allocator: blocks are never reused and all of them are released
+    // together with the arena. Block sizes double up to MAX_BLOCK_SIZE, so at
+    // most one block's worth of memory is reserved ahead of use.
+    class Arena {
+    public:
+        static constexpr size_t MAX_BLOCK_SIZE = 1 << 24;
+
+        explicit Arena(size_t first_block_size = 1 << 16) : next_block_size_(first_block_size) {}
+
+        template <typename T>
+        T* Allocate(size_t count) {
+            return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+        }
+
+        void* Allocate(size_t size, size_t alignment);
+
+        // Forgets every allocation, keeping only the last block for reuse.
+        void Reset();
+
+    private:
+        std::vector<std::unique_ptr<char[]>> blocks_;
+        size_t block_size_ = 0;
+        size_t used_ = 0;
+        size_t next_block_size_;
+    };
+
+    // Parses values from a scanner into nodes allocated in an arena.
+    class Builder {
+    public:
+        Builder(Detail::Scanner& scanner, Arena& arena) : scanner_(scanner), arena_(arena) {}
+
+        Node ParseNode();
+
+    private:
+        Detail::Scanner& scanner_;
+        Arena& arena_;
+        std::vector<Node> elements_stack_;
+        std::vector<Member> members_stack_;
+        std::string decoded_;
+
+        std::string_view ParseString();
+        Node ParseArray();
+        Node ParseObject();
+    };
+
+    class Document {
+    public:
+        Document(Detail::InputBuffer input);
+
+        const Node& GetRoot() const { return root_; }
+
+    private:
+        Detail::InputBuffer input_;
+        Arena arena_;
+        Node root_;
+    };
+
+    // Event-driven alternative to Document for inputs with a root object: members
+    // are reported one by one, and array elements are materialised one at a
+    // time in an arena that is recycled between elements, so the whole tree is
+    // never built.
+    class StreamReader {
+    public:
+        explicit StreamReader(Detail::InputBuffer input);
+
+        // Calls on_member for every key of the root object. The handler must
+        // consume the member value with ReadValue, ReadArray or SkipValue.
+        void ReadRootObject(const std::function<void(std::string_view key)>& on_member);
+
+        // The node lives as long as the reader.
+        const Node& ReadValue();
+        // Each element is valid only during its on_element call.
+        void ReadArray(const std::function<void(const Node& element)>& on_element);
+        void SkipValue();
+
+    private:
+        Detail::InputBuffer input_;
+        Detail::Scanner scanner_;
+        Arena values_arena_;
+        Arena element_arena_;
+        std::vector<std::unique_ptr<Node>> values_;
+        std::string decoded_;
+    };
+
+    Document Load(std::istream& input);
+    Document Load(std::string text);
+    Document LoadFile(const std::string& path);
+
+}
@@ -33,8 +33,233 @@ double ComputeDistance(const Coordinate& lhs, const Coordinate& rhs) {
     ) * 6371000;
 }
 
-void TransportManager::AddStop(string stop_name, Coordinate coordinate) {
-    stops_[stop_name] = make_unique<Stop>(stop_name, coordinate, stops_coutner);
+uint32_t NameInterner::Intern(string_view name) {
+    if (const auto id = Find(name)) {
+        return *id;
+    }
+    const uint32_t id = Size();
+    added_ids_.emplace(*added_names_.emplace_back(make_shared<const string>(name)), id);
+    if (base_.use_count() == 1 || added_names_.size() * added_names_.size() > base_->names.size()) {
+        Fold();
+    }
+    return id;
+}
+
+optional<uint32_t> NameInterner::Find(string_view name) const {
+    if (const auto it = base_->ids.find(name); it != base_->ids.end()) {
+        return it->second;
+    }
+    if (const auto it = added_ids_.find(name); it != added_ids_.end()) {
+        return it->second;
+    }
+    return nullopt;
+}
+
+void NameInterner::Fold() {
+    if (base_.use_count() > 1) {
+        base_ = make_shared<Table>(*base_);
+    }
+    for (auto& name : added_names_) {
+        base_->ids.emplace(*name, base_->names.size());
+        base_->names.push_back(move(name));
+    }
+    added_names_.clear();
+    added_ids_.clear();
+}
+
+void NameInterner::Save(Snapshot::Writer& writer) const {
+    vector<uint32_t> offsets = { 0 };
+    offsets.reserve(Size() + 1);
+    string chars;
+    for (uint32_t id = 0; id < Size(); ++id) {
+        chars += GetName(id);
+        offsets.push_back(chars.size());
+    }
+    writer.WriteVector(offsets);
+    writer.WriteString(chars);
+}
+
+void NameInterner::Load(Snapshot::Reader& reader) {
+    const auto offsets = reader.ReadArray<uint32_t>();
+    const string_view chars = reader.ReadString();
+    if (offsets.empty() || offsets[offsets.size() - 1] != chars.size()) {
+        throw runtime_error("snapshot: inconsistent names");
+    }
+    *this = NameInterner();
+    for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+        Intern(chars.substr(offsets[i], offsets[i + 1] - offsets[i]));
+    }
+}
+
+void DistanceTable::Set(StopId from, StopId to, int distance) {
+    given_[MakeKey(from, to)] = distance;
+    is_resolved_ = false;
+}
+
+optional<int> DistanceTable::FindGiven(StopId from, StopId to) const {
+    if (const auto it = given_.find(MakeKey(from, to)); it != given_.end()) {
+        return it->second;
+    }
+    return nullopt;
+}
+
+optional<int> DistanceTable::Get(StopId from, StopId to) const {
+    if (!is_resolved_) {
+        if (const auto distance = FindGiven(from, to)) {
+            return distance;
+        }
+        return FindGiven(to, from);
+    }
+    if (from + 1 >= offsets_.size()) {
+        return nullopt;
+    }
+    const auto row_begin = entries_.begin() + offsets_[from];
+    const auto row_end = entries_.begin() + offsets_[from + 1];
+    const auto it = lower_bound(row_begin, row_end, to, [](const Entry& entry, StopId stop) {
+        return entry.to < stop;
+    });
+    if (it == row_end || it->to != to) {
+        return nullopt;
+    }
+    return it->distance;
+}
+
+void DistanceTable::Resolve() {
+    vector<pair<uint64_t, int>> distances;
+    distances.reserve(2 * given_.size());
+    for (const auto& [key, distance] : given_) {
+        distances.push_back({ key, distance });
+        const uint64_t reverse_key = MakeKey(static_cast<StopId>(key), static_cast<StopId>(key >> 32));
+        if (!given_.count(reverse_key)) {
+            distances.push_back({ reverse_key, distance });
+        }
+    }
+    sort(distances.begin(), distances.end());
+
+    const size_t row_count = distances.empty() ? 0 : static_cast<size_t>(distances.back().first >> 32) + 1;
+    offsets_.assign(row_count + 1, 0);
+    entries_.clear();
+    entries_.reserve(distances.size());
+    for (const auto& [key, distance] : distances) {
+        ++offsets_[(key >> 32) + 1];
+        entries_.push_back({ static_cast<StopId>(key), distance });
+    }
+    for (size_t row = 0; row < row_count; ++row) {
+        offsets_[row + 1] += offsets_[row];
+    }
+    is_resolved_ = true;
+}
+
+void DistanceTable::Save(Snapshot::Writer& writer) const {
+    vector<pair<uint64_t, int>> given(given_.begin(), given_.end());
+    sort(given.begin(), given.end());
+    vector<uint64_t> keys;
+    vector<int> distances;
+    keys.reserve(given.size());
+    distances.reserve(given.size());
+    for (const auto& [key, distance] : given) {
+        keys.push_back(key);
+        distances.push_back(distance);
+    }
+    writer.WriteVector(keys);
+    writer.WriteVector(distances);
+    writer.Write<uint8_t>(is_resolved_);
+    writer.WriteVector(offsets_);
+    writer.WriteVector(entries_);
+}
+
+void DistanceTable::Load(Snapshot::Reader& reader) {
+    const auto keys = reader.ReadArray<uint64_t>();
+    const auto distances = reader.ReadArray<int>();
+    if (keys.size() != distances.size()) {
+        throw runtime_error("snapshot: inconsistent distances");
+    }
+    given_.clear();
+    given_.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        given_.emplace(keys[i], distances[i]);
+    }
+    is_resolved_ = reader.Read<uint8_t>();
+    offsets_ = reader.ReadVector<uint32_t>();
+    entries_ = reader.ReadVector<Entry>();
+}
+
+RouteCache::RouteCache(size_t capacity_bytes) : shard_capacity_(capacity_bytes / SHARD_COUNT) {}
+
+shared_ptr<const RouteCache::Value> RouteCache::Find(StopId from, StopId to) const {
+    const uint64_t key = MakeKey(from, to);
+    Shard& shard = GetShard(key);
+    lock_guard lock(shard.m);
+    const auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        ++shard.misses;
+        return nullptr;
+    }
+    ++shard.hits;
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    return it->second->value;
+}
+
+void RouteCache::Insert(StopId from, StopId to, shared_ptr<const Value> value) const {
+    const uint64_t key = MakeKey(from, to);
+    // The list node, the index node and the value with what it owns.
+    const size_t bytes = sizeof(Entry) + 4 * sizeof(void*) + sizeof(Value)
+        + (value->overlay ? value->overlay->capacity() : 0) + value->items.capacity() * sizeof(RouteItem);
+    if (bytes > shard_capacity_) {
+        return;
+    }
+    Shard& shard = GetShard(key);
+    lock_guard lock(shard.m);
+    // Another query may have built the same route meanwhile.
+    if (shard.index.count(key)) {
+        return;
+    }
+    while (shard.bytes + bytes > shard_capacity_) {
+        const Entry& last = shard.entries.back();
+        shard.bytes -= last.bytes;
+        shard.index.erase(last.key);
+        shard.entries.pop_back();
+        ++shard.evictions;
+    }
+    shard.entries.push_front({key, move(value), bytes});
+    shard.index.emplace(key, shard.entries.begin());
+    shard.bytes += bytes;
+}
+
+RouteCache::Stats RouteCache::GetStats() const {
+    Stats stats;
+    for (Shard& shard : shards_) {
+        lock_guard lock(shard.m);
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.evictions += shard.evictions;
+        stats.entries += shard.entries.size();
+        stats.bytes += shard.bytes;
+    }
+    return stats;
+}
+
+StopId TransportManager::InternStop(string_view stop_name) {
+    const StopId stop = stop_names_.Intern(stop_name);
+    if (stop == stops_.size()) {
+        stops_.emplace_back();
+    }
+    return stop;
+}
+
+void TransportManager::AddStop(string_view stop_name, Coordinate coordinate) {
+    stop_buses_.clear();
+    bus_stats_.clear();
+    route_cache_.reset();
+    const StopId stop = InternStop(stop_name);
+    size_t indx = declared_stops_.size();
+    if (stops_[stop]) {
+        indx = stops_[stop]->GetIndx().first / 2;
+    }
+    else {
+        declared_stops_.push_back(stop);
+    }
+    stops_[stop] = make_shared<const Stop>(stop, stop_names_.GetName(stop), coordinate, indx);
     if (stops_coutner == 0) {
         min_coordinate = max_coordinate = coordinate;
     }
@@ -44,38 +269,155 @@ void TransportManager::AddStop(string stop_name, Coordinate coordinate) {
         max_coordinate.latitude = max(max_coordinate.latitude, coordinate.latitude);
         max_coordinate.longitude = max(max_coordinate.longitude, coordinate.longitude);
     }
-    stops_coutner += 2;
+    stops_coutner++;
+}
+
+void TransportManager::AddBus(string_view bus_name, const vector<string>& stops, bool is_reversed) {
+    stop_buses_.clear();
+    bus_stats_.clear();
+    route_cache_.reset();
+    vector<StopId> route;
+    route.reserve(stops.size());
+    for (const auto& stop_name : stops) {
+        route.push_back(InternStop(stop_name));
+    }
+    const BusId bus = bus_names_.Intern(bus_name);
+    if (router_origin_ && bus < router_origin_->bus_count) {
+        router_origin_.reset();
+    }
+    if (bus == buses_.size()) {
+        buses_.emplace_back();
+    }
+    buses_[bus] = make_shared<const Bus>(bus, bus_names_.GetName(bus), move(route), is_reversed);
+    if (bus < bus_timetables_.size()) {
+        bus_timetables_[bus].reset();
+    }
+}
+
+void TransportManager::SetBusTimetable(string_view bus_name, vector<vector<double>> trips) {
+    const Bus* bus = FindBus(bus_name);
+    if (!bus) {
+        throw out_of_range("unknown bus");
+    }
+    for (const auto& trip : trips) {
+        if (trip.size() != bus->GetStopsNum()) {
+            throw invalid_argument("trip does not match the route of bus " + string(bus_name));
+        }
+        if (!is_sorted(trip.begin(), trip.end())) {
+            throw invalid_argument("trip goes back in time on bus " + string(bus_name));
+        }
+    }
+    if (bus_timetables_.size() <= bus->GetId()) {
+        bus_timetables_.resize(bus->GetId() + 1);
+    }
+    bus_timetables_[bus->GetId()] = make_shared<const vector<vector<double>>>(move(trips));
+}
+
+void TransportManager::AddDistance(string_view from, string_view to, int distance) {
+    bus_stats_.clear();
+    const StopId from_stop = InternStop(from);
+    GetMutableDistances().Set(from_stop, InternStop(to), distance);
 }
 
-void TransportManager::AddBus(string bus_name, vector<string> stops, bool is_reversed) {
-    buses_[bus_name] = make_unique<Bus>(bus_name, move(stops), is_reversed);
+DistanceTable& TransportManager::GetMutableDistances() {
+    if (distances_.use_count() > 1) {
+        distances_ = make_shared<DistanceTable>(*distances_);
+    }
+    return *distances_;
+}
+
+const Stop* TransportManager::FindStop(string_view stop_name) const {
+    const auto stop = stop_names_.Find(stop_name);
+    return stop ? stops_[*stop].get() : nullptr;
+}
+
+const Bus* TransportManager::FindBus(string_view bus_name) const {
+    const auto bus = bus_names_.Find(bus_name);
+    return bus ? buses_[*bus].get() : nullptr;
+}
+
+vector<BusId> TransportManager::GetStopBuses(StopId stop) const {
+    return stop < stop_buses_.size() ? stop_buses_[stop] : ComputeStopBuses(stop);
+}
+
+NetworkValidation TransportManager::Finalize() {
+    if (!distances_->IsResolved()) {
+        GetMutableDistances().Resolve();
+    }
+    BuildStopBuses();
+    BuildBusStats();
+    return Validate();
+}
+
+NetworkValidation TransportManager::Validate() const {
+    NetworkValidation validation;
+    for (const auto& bus : buses_) {
+        const auto& stops = bus->GetStops();
+        for (size_t i = 1; i < stops.size(); ++i) {
+            if (!GetRoadDistance(stops[i - 1], stops[i])) {
+                validation.missing_distances.push_back({ bus->GetId(), stops[i - 1], stops[i] });
+            }
+        }
+    }
+    return validation;
+}
+
+void TransportManager::BuildStopBuses() {
+    stop_buses_.assign(stops_.size(), {});
+    for (const auto& bus : buses_) {
+        for (const StopId stop : bus->GetStops()) {
+            auto& buses = stop_buses_[stop];
+            if (buses.empty() || buses.back() != bus->GetId()) {
+                buses.push_back(bus->GetId());
+            }
+        }
+    }
+    for (auto& buses : stop_buses_) {
+        SortBusesByName(buses);
+    }
 }
 
-void TransportManager::AddDistance(const string& from, const string& to, int distance) {
-    stops_[from].get()->AddDistance(to, distance);
+vector<BusId> TransportManager::ComputeStopBuses(StopId stop) const {
+    vector<BusId> buses;
+    for (const auto& bus : buses_) {
+        const auto& stops = bus->GetStops();
+        if (find(stops.begin(), stops.end(), stop) != stops.end()) {
+            buses.push_back(bus->GetId());
+        }
+    }
+    SortBusesByName(buses);
+    return buses;
 }
 
-const Bus* TransportManager::TransportManager::GetBus(const string& bus_name) const {
-    if (buses_.count(bus_name))
-        return buses_.at(bus_name).get();
-    return nullptr;
+void TransportManager::SortBusesByName(vector<BusId>& buses) const {
+    sort(buses.begin(), buses.end(), [this](BusId lhs, BusId rhs) {
+        return buses_[lhs]->GetName() < buses_[rhs]->GetName();
+    });
+    buses.erase(unique(buses.begin(), buses.end()), buses.end());
 }
 
-const unordered_map<string, unique_ptr<Bus>>& TransportManager::GetBuses() const {
-    return buses_;
+BusStats TransportManager::GetBusStats(BusId bus) const {
+    return bus < bus_stats_.size() ? bus_stats_[bus] : ComputeBusStats(*buses_[bus]);
 }
 
-const unordered_map<string, unique_ptr<Stop>>& TransportManager::GetStops() const {
-    return stops_;
+void TransportManager::BuildBusStats() {
+    bus_stats_.clear();
+    bus_stats_.reserve(buses_.size());
+    for (const auto& bus : buses_) {
+        bus_stats_.push_back(ComputeBusStats(*bus));
+    }
 }
 
-const Stop* TransportManager::GetStop(const string& stop_name) const {
-    if (stops_.count(stop_name))
-        return stops_.at(stop_name).get();
-    return nullptr;
+BusStats TransportManager::ComputeBusStats(const Bus& bus) const {
+    BusStats stats;
+    stats.stop_count = bus.GetStopsNum();
+    stats.unique_stop_count = bus.GetUniqueStopsNum();
+    stats.route_length = bus.GetLength(*this);
+    stats.curvature = stats.route_length / bus.GetGeographicDistance(*this);
+    return stats;
 }
 
-bool Bus::IsEnding(string_view stop) const {
+bool Bus::IsEnding(StopId stop) const {
     if (stop == stops_.front() || (is_reversed_ && stop == stops_.back())) return true;
     return false;
 }
@@ -84,108 +426,784 @@ bool Bus::IsEnding(string_view stop) const {
 int Bus::GetLength(const TransportManager& manager) const {
     int length = 0;
     for (size_t i = 0; i < stops_.size() - 1; ++i) {
-        int distance_between_stops = 0;
-        try {
-            distance_between_stops = manager.GetStop(stops_[i])->GetDistance(stops_[i + 1]);
-        }
-        catch (...) {
-            distance_between_stops = manager.GetStop(stops_[i + 1])->GetDistance(stops_[i]);
-        }
-        length += distance_between_stops;
+        length += manager.GetRoadDistance(stops_[i], stops_[i + 1]).value_or(0);
     }
     if (is_reversed_) {
         for (size_t i = stops_.size() - 1; i > 0; --i) {
-            int distance_between_stops = 0;
-            try {
-                distance_between_stops = manager.GetStop(stops_[i])->GetDistance(stops_[i - 1]);
-            }
-            catch (...) {
-                distance_between_stops = manager.GetStop(stops_[i - 1])->GetDistance(stops_[i]);
-            }
-            length += distance_between_stops;
+            length += manager.GetRoadDistance(stops_[i], stops_[i - 1]).value_or(0);
         }
     }
     return length;
 }
 
-void TransportManager::BuildRouter() {
-    graph_ = make_unique<Graph::DirectedWeightedGraph<double>>(stops_.size() * 2);
-    auto& graph = *graph_.get();
-    Graph::Edge<double> edge;
+double TransportManager::GetRideTime(const vector<int>& bus_distances, size_t span_start, size_t span_count) const {
+    const double distance = bus_distances[span_start + span_count] - bus_distances[span_start];
+    return (distance / (bus_velocity_ * 1000.0)) * 60;
+}
+
+RouteItem TransportManager::MakeBusItem(BusId bus, size_t span_start, size_t span_count) const {
+    const Bus* route_bus = buses_[bus].get();
+    return {
+        RouteItemType::BUS, route_bus->GetName(), GetRideTime(routing_->bus_distances[bus], span_start, span_count),
+        span_count, route_bus, span_start, stops_[route_bus->GetRouteStop(span_start + span_count)].get()
+    };
+}
+
+// Calls callback(first, last) for every run of route positions a bus covers
+// without turning back: the whole route of a roundtrip bus, and each half of
+// a non-roundtrip one.
+template <typename ChainCallback>
+void TransportManager::ForEachChain(const Bus& bus, ChainCallback callback) {
+    const size_t last = bus.GetStops().size() - 1;
+    callback(0, last);
+    if (bus.IsReversed()) {
+        callback(last, 2 * last);
+    }
+}
+
+void TransportManager::AddWaitEdges(Graph::DirectedWeightedGraph<double>& graph, RouteEdgesInfo& edges_info, vector<bool>& waiting_stops) const {
+    waiting_stops.resize(stops_.size(), false);
     for (const auto& stop : stops_) {
-        auto vertexes = stop.second->GetIndx();
-        edge.from = vertexes.first;
-        edge.to = vertexes.second;
-        edge.type = "Wait";
-        edge.text = stop.first;
-        edge.weight = bus_wait_time_;
-        graph.AddEdge(edge);
+        if (!stop || waiting_stops[stop->GetId()]) {
+            continue;
+        }
+        const auto vertexes = stop->GetIndx();
+        graph.AddEdge({ vertexes.first, vertexes.second, static_cast<double>(bus_wait_time_) });
+        edges_info.Add(RouteEdgeType::WAIT, stop->GetId(), 0, 0);
+        waiting_stops[stop->GetId()] = true;
     }
+}
+
+void TransportManager::AddSpanEdges(Graph::DirectedWeightedGraph<double>& graph, RouteEdgesInfo& edges_info,
+                                    const vector<vector<int>>& bus_distances, BusId first_bus) const {
+    // Buses add their edges in the order of a hash map of names filled in
+    // declaration order, as when the manager kept its buses in one; equally
+    // fast routes then resolve to the same one.
+    unordered_map<string_view, BusId> buses_by_name;
+    for (BusId bus = first_bus; bus < buses_.size(); ++bus)
+        buses_by_name.emplace(buses_[bus]->GetName(), bus);
+    for (const auto& [name, bus_id] : buses_by_name) {
+        const auto& bus = buses_[bus_id];
+        ForEachChain(*bus, [&](size_t first, size_t last) {
+            for (size_t j = first; j < last; ++j) {
+                const Graph::VertexId from = stops_[bus->GetRouteStop(j)]->GetIndx().second;
+                for (size_t i = j + 1; i <= last; ++i) {
+                    graph.AddEdge({ from, stops_[bus->GetRouteStop(i)]->GetIndx().first, GetRideTime(bus_distances[bus->GetId()], j, i - j) });
+                    edges_info.Add(RouteEdgeType::BUS, bus->GetId(), j, i - j);
+                }
+            }
+        });
+    }
+}
+
+void TransportManager::AddRideEdges(Graph::DirectedWeightedGraph<double>& graph, RouteEdgesInfo& edges_info,
+                                    const vector<vector<int>>& bus_distances) const {
+    Graph::VertexId ride_vertex = stops_.size() * 2;
     for (const auto& bus : buses_) {
-        edge.type = "Bus";
-        edge.text = bus.first;
-        const auto& stops = bus.second->GetStops();
-        for (size_t j = 0; j < stops.size() - 1; ++j) {
-            double distance = 0.0;
-            edge.stops_list.clear();
-            edge.stop_count = 0;
-            for (size_t i = j; i < stops.size() - 1; ++i) {
-                int distance_between_stops = 0;
-                try {
-                    distance_between_stops = GetStop(stops[i])->GetDistance(stops[i + 1]);
+        ForEachChain(*bus, [&](size_t first, size_t last) {
+            for (size_t position = first; position <= last; ++position, ++ride_vertex) {
+                const auto stop_vertexes = stops_[bus->GetRouteStop(position)]->GetIndx();
+                if (position != last) {
+                    graph.AddEdge({ stop_vertexes.second, ride_vertex, 0 });
+                    edges_info.Add(RouteEdgeType::BOARD, bus->GetId(), position, 0);
+                    graph.AddEdge({ ride_vertex, ride_vertex + 1, GetRideTime(bus_distances[bus->GetId()], position, 1) });
+                    edges_info.Add(RouteEdgeType::RIDE, bus->GetId(), position, 1);
                 }
-                catch (...) {
-                    distance_between_stops = GetStop(stops[i + 1])->GetDistance(stops[i]);
+                if (position != first) {
+                    graph.AddEdge({ ride_vertex, stop_vertexes.first, 0 });
+                    edges_info.Add(RouteEdgeType::ALIGHT, bus->GetId(), position, 0);
                 }
-                edge.stops_list.push_back({ stops[i] , stops[i + 1] });
-                distance += distance_between_stops;
-                edge.stop_count++;
-                edge.from = GetStop(stops[j])->GetIndx().second;
-                edge.to = GetStop(stops[i + 1])->GetIndx().first;
-                edge.weight = (distance / (bus_velocity_ * 1000.0)) * 60;
-                graph.AddEdge(edge);
             }
+        });
+    }
+}
+
+vector<vector<int>> TransportManager::ComputeBusDistances() const {
+    vector<vector<int>> bus_distances;
+    bus_distances.reserve(buses_.size());
+    for (const auto& bus : buses_) {
+        const size_t route_size = bus->GetStopsNum();
+        vector<int> distances(route_size, 0);
+        for (size_t position = 1; position < route_size; ++position) {
+            distances[position] = distances[position - 1]
+                + GetRoadDistance(bus->GetRouteStop(position - 1), bus->GetRouteStop(position)).value_or(0);
         }
-        if (bus.second->IsReversed()) {
-            for (size_t j = stops.size() - 1; j > 0; --j) {
-                double distance = 0.0;
-                edge.stop_count = 0;
-                edge.stops_list.clear();
-                for (size_t i = j; i > 0; --i) {
-                    int distance_between_stops = 0;
-                    try {
-                        distance_between_stops = GetStop(stops[i])->GetDistance(stops[i - 1]);
-                    }
-                    catch (...) {
-                        distance_between_stops = GetStop(stops[i - 1])->GetDistance(stops[i]);
-                    }
-                    edge.stops_list.push_back({ stops[i] , stops[i - 1] });
-                    distance += distance_between_stops;
-                    edge.weight = (distance / (bus_velocity_ * 1000.0)) * 60;
-                    edge.stop_count++;
-                    edge.from = GetStop(stops[j])->GetIndx().second;
-                    edge.to = GetStop(stops[i - 1])->GetIndx().first;
-                    graph.AddEdge(edge);
+        bus_distances.push_back(move(distances));
+    }
+    return bus_distances;
+}
+
+bool TransportManager::CanExtendRouter(const vector<vector<int>>& bus_distances) const {
+    if (!routing_ || !router_origin_ || router_type_ != Graph::RouterType::ALL_PAIRS) {
+        return false;
+    }
+    const auto& origin = *router_origin_;
+    if (origin.router_type != router_type_ || origin.bus_wait_time != bus_wait_time_ || origin.bus_velocity != bus_velocity_) {
+        return false;
+    }
+    for (BusId bus = 0; bus < origin.bus_count; ++bus) {
+        if (bus_distances[bus] != routing_->bus_distances[bus]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TransportManager::ExtendRouter(vector<vector<int>> bus_distances) {
+    auto& origin = *router_origin_;
+    const Routing& base = *routing_;
+    Graph::DirectedWeightedGraph<double> added(stops_.size() * 2);
+    RouteEdgesInfo added_info;
+    AddWaitEdges(added, added_info, origin.waiting_stops);
+    AddSpanEdges(added, added_info, bus_distances, origin.bus_count);
+    origin.bus_count = buses_.size();
+
+    auto routing = make_shared<Routing>();
+    routing->bus_distances = move(bus_distances);
+    if (added.GetEdgeCount() == 0 && added.GetVertexCount() == base.graph->GetVertexCount()) {
+        routing->edges_info = base.edges_info;
+        routing->graph = base.graph;
+        routing->router = base.router;
+        routing->pareto_router = base.pareto_router;
+        routing->alternative_router = base.alternative_router;
+        routing_ = move(routing);
+        return;
+    }
+    vector<Graph::EdgeId> edge_order;
+    auto graph = make_shared<Graph::CompactGraph<double>>(*base.graph, added, &edge_order);
+    routing->graph = graph;
+    // CanExtendRouter only lets the all-pairs router through.
+    const auto& base_router = static_cast<const Graph::Router<double>&>(*base.router);
+    routing->router = make_shared<Graph::Router<double>>(base_router, *graph, edge_order);
+
+    const size_t base_edge_count = base.graph->GetEdgeCount();
+    for (const Graph::EdgeId edge_id : edge_order) {
+        const auto& info = edge_id < base_edge_count ? base.edges_info : added_info;
+        const Graph::EdgeId info_id = edge_id < base_edge_count ? edge_id : edge_id - base_edge_count;
+        routing->edges_info.Add(info.types[info_id], info.owners[info_id], info.span_starts[info_id], info.span_counts[info_id]);
+    }
+    BuildAlternativeRouters(*routing);
+    routing_ = move(routing);
+}
+
+void TransportManager::BuildRouter() {
+    auto bus_distances = ComputeBusDistances();
+    BuildTimetableRouter();
+    if (CanExtendRouter(bus_distances)) {
+        ExtendRouter(move(bus_distances));
+        ResetRouteCache();
+        return;
+    }
+    size_t ride_vertex_count = 0;
+    for (const auto& bus : buses_) {
+        ride_vertex_count += bus->GetStopsNum() + (bus->IsReversed() ? 1 : 0);
+    }
+
+    // The all-pairs table takes cubic time in vertices, and the ride model adds
+    // one per route position, so the default router keeps the span model with
+    // its quadratic number of BUS edges per bus.
+    const bool use_ride_model = router_type_ != Graph::RouterType::ALL_PAIRS;
+    Graph::DirectedWeightedGraph<double> graph(stops_.size() * 2 + (use_ride_model ? ride_vertex_count : 0));
+    RouteEdgesInfo edges_info;
+    RouterOrigin origin{ bus_wait_time_, bus_velocity_, router_type_, buses_.size(), {} };
+    AddWaitEdges(graph, edges_info, origin.waiting_stops);
+    if (use_ride_model) {
+        AddRideEdges(graph, edges_info, bus_distances);
+    }
+    else {
+        AddSpanEdges(graph, edges_info, bus_distances);
+    }
+
+    auto routing = make_shared<Routing>();
+    routing->bus_distances = move(bus_distances);
+    vector<Graph::EdgeId> edge_order;
+    auto compact_graph = make_shared<Graph::CompactGraph<double>>(graph, &edge_order);
+    routing->graph = compact_graph;
+    for (const Graph::EdgeId edge_id : edge_order) {
+        routing->edges_info.Add(
+            edges_info.types[edge_id],
+            edges_info.owners[edge_id],
+            edges_info.span_starts[edge_id],
+            edges_info.span_counts[edge_id]
+        );
+    }
+
+    switch (router_type_) {
+    case Graph::RouterType::DIJKSTRA:
+        routing->router = make_shared<Graph::DijkstraRouter<double>>(*compact_graph);
+        break;
+    case Graph::RouterType::CONTRACTION_HIERARCHIES:
+        routing->router = make_shared<Graph::ContractionHierarchiesRouter<double>>(*compact_graph);
+        break;
+    default:
+        routing->router = make_shared<Graph::Router<double>>(*compact_graph);
+        break;
+    }
+    BuildAlternativeRouters(*routing);
+    routing_ = move(routing);
+    router_origin_ = move(origin);
+    ResetRouteCache();
+}
+
+void TransportManager::BuildAlternativeRouters(Routing& routing) {
+    const auto& types = routing.edges_info.types;
+    vector<uint8_t> boardings(types.size());
+    for (size_t edge_id = 0; edge_id < types.size(); ++edge_id) {
+        boardings[edge_id] = types[edge_id] == RouteEdgeType::WAIT;
+    }
+    routing.pareto_router = make_shared<const Graph::ParetoRouter<double>>(*routing.graph, move(boardings));
+    routing.alternative_router = make_shared<const Graph::YenRouter<double>>(*routing.graph);
+}
+
+void TransportManager::BuildTimetableRouter() {
+    vector<Raptor::BusTimetable> timetables;
+    for (BusId bus = 0; bus < bus_timetables_.size(); ++bus) {
+        if (!bus_timetables_[bus]) {
+            continue;
+        }
+        vector<StopId> stops(buses_[bus]->GetStopsNum());
+        for (size_t position = 0; position < stops.size(); ++position) {
+            stops[position] = buses_[bus]->GetRouteStop(position);
+        }
+        timetables.push_back({ bus, move(stops), *bus_timetables_[bus] });
+    }
+    timetable_router_ = timetables.empty() ? nullptr : make_shared<const Raptor::TimetableRouter>(stops_.size(), timetables);
+}
+
+// Nested vectors are stored as row offsets followed by the concatenated rows.
+template <typename T>
+void WriteRows(Snapshot::Writer& writer, const vector<vector<T>>& rows) {
+    vector<uint64_t> offsets = { 0 };
+    offsets.reserve(rows.size() + 1);
+    vector<T> values;
+    for (const auto& row : rows) {
+        values.insert(values.end(), row.begin(), row.end());
+        offsets.push_back(values.size());
+    }
+    writer.WriteVector(offsets);
+    writer.WriteVector(values);
+}
+
+template <typename T>
+vector<vector<T>> ReadRows(Snapshot::Reader& reader) {
+    const auto offsets = reader.ReadArray<uint64_t>();
+    const auto values = reader.ReadArray<T>();
+    if (offsets.empty() || offsets[offsets.size() - 1] != values.size()) {
+        throw runtime_error("snapshot: inconsistent rows");
+    }
+    vector<vector<T>> rows;
+    rows.reserve(offsets.size() - 1);
+    for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+        rows.emplace_back(values.begin() + offsets[i], values.begin() + offsets[i + 1]);
+    }
+    return rows;
+}
+
+void TransportManager::SaveSnapshot(const string& path) const {
+    if (!routing_ || !map_ || !reoute_renderer) {
+        throw logic_error("snapshot requires a built router and map");
+    }
+    Snapshot::Writer writer;
+    writer.Write<uint64_t>(bus_wait_time_);
+    writer.Write<uint64_t>(bus_velocity_);
+    writer.Write(router_type_);
+    writer.Write<uint64_t>(stops_coutner);
+    writer.Write(min_coordinate);
+    writer.Write(max_coordinate);
+
+    stop_names_.Save(writer);
+    vector<uint8_t> is_declared;
+    vector<Coordinate> coordinates;
+    for (const auto& stop : stops_) {
+        is_declared.push_back(stop != nullptr);
+        coordinates.push_back(stop ? stop->GetCoordinate() : Coordinate());
+    }
+    writer.WriteVector(is_declared);
+    writer.WriteVector(coordinates);
+    writer.WriteVector(declared_stops_);
+
+    bus_names_.Save(writer);
+    vector<uint8_t> is_reversed;
+    vector<vector<StopId>> routes;
+    for (const auto& bus : buses_) {
+        is_reversed.push_back(bus->IsReversed());
+        routes.push_back(bus->GetStops());
+    }
+    writer.WriteVector(is_reversed);
+    WriteRows(writer, routes);
+
+    distances_->Save(writer);
+    WriteRows(writer, stop_buses_);
+    // Field by field: the padding inside BusStats would make equal models
+    // write different files.
+    vector<uint64_t> stop_counts;
+    vector<uint64_t> unique_stop_counts;
+    vector<int> route_lengths;
+    vector<double> curvatures;
+    for (const auto& stats : bus_stats_) {
+        stop_counts.push_back(stats.stop_count);
+        unique_stop_counts.push_back(stats.unique_stop_count);
+        route_lengths.push_back(stats.route_length);
+        curvatures.push_back(stats.curvature);
+    }
+    writer.WriteVector(stop_counts);
+    writer.WriteVector(unique_stop_counts);
+    writer.WriteVector(route_lengths);
+    writer.WriteVector(curvatures);
+
+    WriteRows(writer, routing_->bus_distances);
+    writer.WriteVector(routing_->edges_info.types);
+    writer.WriteVector(routing_->edges_info.owners);
+    writer.WriteVector(routing_->edges_info.span_starts);
+    writer.WriteVector(routing_->edges_info.span_counts);
+    routing_->graph->Save(writer);
+    routing_->router->Save(writer);
+    writer.Write<uint8_t>(router_origin_.has_value());
+    if (router_origin_) {
+        writer.Write<uint64_t>(router_origin_->bus_wait_time);
+        writer.Write<uint64_t>(router_origin_->bus_velocity);
+        writer.Write(router_origin_->router_type);
+        writer.Write<uint64_t>(router_origin_->bus_count);
+        writer.WriteVector(vector<uint8_t>(router_origin_->waiting_stops.begin(), router_origin_->waiting_stops.end()));
+    }
+    // Timetables are kept as given; the timetable router is rebuilt from them.
+    vector<uint64_t> trip_counts;
+    vector<vector<double>> trips;
+    for (const auto& timetable : bus_timetables_) {
+        trip_counts.push_back(timetable ? timetable->size() : 0);
+        if (timetable) {
+            trips.insert(trips.end(), timetable->begin(), timetable->end());
+        }
+    }
+    writer.WriteVector(trip_counts);
+    WriteRows(writer, trips);
+
+    map_->Save(writer);
+    reoute_renderer->Save(writer);
+    writer.SaveFile(path);
+}
+
+void TransportManager::CheckRouting(const Routing& routing) const {
+    if (routing.bus_distances.size() != buses_.size()) {
+        throw runtime_error("snapshot: inconsistent bus distances");
+    }
+    for (BusId bus = 0; bus < buses_.size(); ++bus) {
+        if (routing.bus_distances[bus].size() != buses_[bus]->GetStopsNum()) {
+            throw runtime_error("snapshot: inconsistent bus distances");
+        }
+    }
+    if (routing.graph->GetVertexCount() < 2 * declared_stops_.size()) {
+        throw runtime_error("snapshot: inconsistent graph");
+    }
+    const auto& edges_info = routing.edges_info;
+    const size_t edge_count = routing.graph->GetEdgeCount();
+    if (edges_info.types.size() != edge_count || edges_info.owners.size() != edge_count
+            || edges_info.span_starts.size() != edge_count || edges_info.span_counts.size() != edge_count) {
+        throw runtime_error("snapshot: inconsistent edges");
+    }
+    for (size_t edge_id = 0; edge_id < edge_count; ++edge_id) {
+        const uint32_t owner = edges_info.owners[edge_id];
+        switch (edges_info.types[edge_id]) {
+        case RouteEdgeType::WAIT:
+            if (owner >= stops_.size() || !stops_[owner]) {
+                throw runtime_error("snapshot: inconsistent edges");
+            }
+            break;
+        case RouteEdgeType::BUS:
+        case RouteEdgeType::BOARD:
+        case RouteEdgeType::RIDE:
+        case RouteEdgeType::ALIGHT:
+            if (owner >= buses_.size() || static_cast<uint64_t>(edges_info.span_starts[edge_id]) + edges_info.span_counts[edge_id]
+                    >= buses_[owner]->GetStopsNum()) {
+                throw runtime_error("snapshot: inconsistent edges");
+            }
+            break;
+        default:
+            throw runtime_error("snapshot: inconsistent edges");
+        }
+    }
+}
+
+void TransportManager::LoadSnapshot(const string& path, bool verify_checksum) {
+    Snapshot::Reader reader(path, verify_checksum);
+    const size_t route_cache_capacity = route_cache_capacity_;
+    *this = TransportManager();
+    route_cache_capacity_ = route_cache_capacity;
+    bus_wait_time_ = reader.Read<uint64_t>();
+    bus_velocity_ = reader.Read<uint64_t>();
+    router_type_ = reader.Read<Graph::RouterType>();
+    stops_coutner = reader.Read<uint64_t>();
+    min_coordinate = reader.Read<Coordinate>();
+    max_coordinate = reader.Read<Coordinate>();
+
+    stop_names_.Load(reader);
+    const auto is_declared = reader.ReadArray<uint8_t>();
+    const auto coordinates = reader.ReadArray<Coordinate>();
+    if (is_declared.size() != stop_names_.Size() || coordinates.size() != stop_names_.Size()) {
+        throw runtime_error("snapshot: inconsistent stops");
+    }
+    stops_.resize(stop_names_.Size());
+    declared_stops_ = reader.ReadVector<StopId>();
+    for (size_t indx = 0; indx < declared_stops_.size(); ++indx) {
+        const StopId stop = declared_stops_[indx];
+        if (stop >= stops_.size() || !is_declared[stop] || stops_[stop]) {
+            throw runtime_error("snapshot: inconsistent stops");
+        }
+        stops_[stop] = make_shared<const Stop>(stop, stop_names_.GetName(stop), coordinates[stop], indx);
+    }
+    if (declared_stops_.size() != static_cast<size_t>(count(is_declared.begin(), is_declared.end(), 1))) {
+        throw runtime_error("snapshot: inconsistent stops");
+    }
+
+    bus_names_.Load(reader);
+    const auto is_reversed = reader.ReadArray<uint8_t>();
+    auto routes = ReadRows<StopId>(reader);
+    if (is_reversed.size() != bus_names_.Size() || routes.size() != bus_names_.Size()) {
+        throw runtime_error("snapshot: inconsistent buses");
+    }
+    buses_.reserve(routes.size());
+    for (BusId bus = 0; bus < routes.size(); ++bus) {
+        if (routes[bus].empty()) {
+            throw runtime_error("snapshot: inconsistent buses");
+        }
+        for (const StopId stop : routes[bus]) {
+            if (stop >= stops_.size() || !stops_[stop]) {
+                throw runtime_error("snapshot: inconsistent buses");
+            }
+        }
+        buses_.push_back(make_shared<const Bus>(bus, bus_names_.GetName(bus), move(routes[bus]), is_reversed[bus]));
+    }
+
+    distances_->Load(reader);
+    stop_buses_ = ReadRows<BusId>(reader);
+    if (!stop_buses_.empty() && stop_buses_.size() != stops_.size()) {
+        throw runtime_error("snapshot: inconsistent stop buses");
+    }
+    for (const auto& buses : stop_buses_) {
+        for (const BusId bus : buses) {
+            if (bus >= buses_.size()) {
+                throw runtime_error("snapshot: inconsistent stop buses");
+            }
+        }
+    }
+    const auto stop_counts = reader.ReadArray<uint64_t>();
+    const auto unique_stop_counts = reader.ReadArray<uint64_t>();
+    const auto route_lengths = reader.ReadArray<int>();
+    const auto curvatures = reader.ReadArray<double>();
+    if (unique_stop_counts.size() != stop_counts.size() || route_lengths.size() != stop_counts.size()
+            || curvatures.size() != stop_counts.size() || (!stop_counts.empty() && stop_counts.size() != buses_.size())) {
+        throw runtime_error("snapshot: inconsistent bus statistics");
+    }
+    bus_stats_.reserve(stop_counts.size());
+    for (size_t bus = 0; bus < stop_counts.size(); ++bus) {
+        bus_stats_.push_back({ stop_counts[bus], unique_stop_counts[bus], route_lengths[bus], curvatures[bus] });
+    }
+
+    auto routing = make_shared<Routing>();
+    routing->bus_distances = ReadRows<int>(reader);
+    routing->edges_info.types = reader.ReadVector<RouteEdgeType>();
+    routing->edges_info.owners = reader.ReadVector<uint32_t>();
+    routing->edges_info.span_starts = reader.ReadVector<uint32_t>();
+    routing->edges_info.span_counts = reader.ReadVector<uint32_t>();
+    auto graph = make_shared<Graph::CompactGraph<double>>(reader);
+    routing->graph = graph;
+    CheckRouting(*routing);
+    switch (router_type_) {
+    case Graph::RouterType::DIJKSTRA:
+        routing->router = make_shared<Graph::DijkstraRouter<double>>(*graph);
+        break;
+    case Graph::RouterType::CONTRACTION_HIERARCHIES:
+        routing->router = make_shared<Graph::ContractionHierarchiesRouter<double>>(*graph, reader);
+        break;
+    default:
+        routing->router = make_shared<Graph::Router<double>>(*graph, reader);
+        break;
+    }
+    BuildAlternativeRouters(*routing);
+    routing_ = move(routing);
+    if (reader.Read<uint8_t>()) {
+        RouterOrigin origin;
+        origin.bus_wait_time = reader.Read<uint64_t>();
+        origin.bus_velocity = reader.Read<uint64_t>();
+        origin.router_type = reader.Read<Graph::RouterType>();
+        origin.bus_count = reader.Read<uint64_t>();
+        const auto waiting_stops = reader.ReadArray<uint8_t>();
+        if (origin.bus_count > buses_.size() || waiting_stops.size() > stops_.size()) {
+            throw runtime_error("snapshot: inconsistent router origin");
+        }
+        origin.waiting_stops.assign(waiting_stops.begin(), waiting_stops.end());
+        router_origin_ = move(origin);
+    }
+    const auto trip_counts = reader.ReadArray<uint64_t>();
+    auto trips = ReadRows<double>(reader);
+    if (trip_counts.size() > buses_.size()) {
+        throw runtime_error("snapshot: inconsistent timetables");
+    }
+    bus_timetables_.resize(trip_counts.size());
+    size_t trip_idx = 0;
+    for (BusId bus = 0; bus < trip_counts.size(); ++bus) {
+        if (trip_counts[bus] == 0) {
+            continue;
+        }
+        if (trip_counts[bus] > trips.size() - trip_idx) {
+            throw runtime_error("snapshot: inconsistent timetables");
+        }
+        for (size_t trip = trip_idx; trip < trip_idx + trip_counts[bus]; ++trip) {
+            if (trips[trip].size() != buses_[bus]->GetStopsNum()) {
+                throw runtime_error("snapshot: inconsistent timetables");
+            }
+        }
+        bus_timetables_[bus] = make_shared<const vector<vector<double>>>(
+            make_move_iterator(trips.begin() + trip_idx), make_move_iterator(trips.begin() + trip_idx + trip_counts[bus]));
+        trip_idx += trip_counts[bus];
+    }
+    BuildTimetableRouter();
+
+    map_ = make_shared<Map::Map>(reader);
+    reoute_renderer = make_shared<Map::RouteRenderer>(map_, reader);
+    ResetRouteCache();
+}
+
+void TransportManager::ResetRouteCache() {
+    if (routing_ && reoute_renderer && route_cache_capacity_ > 0) {
+        route_cache_ = make_shared<const RouteCache>(route_cache_capacity_);
+    }
+    else {
+        route_cache_.reset();
+    }
+}
+
+pair<string, vector<RouteItem>> TransportManager::GetRoute(string_view from, string_view to) const {
+    const Stop* from_stop = FindStop(from);
+    const Stop* to_stop = FindStop(to);
+    if (!from_stop || !to_stop) {
+        throw out_of_range("unknown stop");
+    }
+    if (!route_cache_) {
+        return ComposeRoute(BuildRoute(*from_stop, *to_stop));
+    }
+    if (auto cached = route_cache_->Find(from_stop->GetId(), to_stop->GetId())) {
+        return ComposeRoute(*cached);
+    }
+    auto route = make_shared<const RouteCache::Value>(BuildRoute(*from_stop, *to_stop));
+    route_cache_->Insert(from_stop->GetId(), to_stop->GetId(), route);
+    return ComposeRoute(*route);
+}
+
+pair<string, vector<RouteItem>> TransportManager::GetRoute(string_view from, string_view to, double departure_time) const {
+    const Stop* from_stop = FindStop(from);
+    const Stop* to_stop = FindStop(to);
+    if (!from_stop || !to_stop) {
+        throw out_of_range("unknown stop");
+    }
+    if (!timetable_router_) {
+        return GetRoute(from, to);
+    }
+    const auto journey = timetable_router_->FindJourney(from_stop->GetId(), to_stop->GetId(), departure_time);
+    if (!journey) {
+        return {};
+    }
+    vector<RouteItem> items;
+    double time = departure_time;
+    for (const auto& leg : journey->legs) {
+        const Bus* bus = buses_[leg.bus].get();
+        const Stop* board_stop = stops_[bus->GetRouteStop(leg.board_position)].get();
+        items.push_back({ RouteItemType::WAIT, board_stop->GetName(), leg.departure - time, 0, nullptr, 0, board_stop });
+        items.push_back({
+            RouteItemType::BUS, bus->GetName(), leg.arrival - leg.departure, leg.alight_position - leg.board_position,
+            bus, leg.board_position, stops_[bus->GetRouteStop(leg.alight_position)].get()
+        });
+        time = leg.arrival;
+    }
+    return { reoute_renderer->RenderRoute(items), move(items) };
+}
+
+vector<pair<string, vector<RouteItem>>> TransportManager::GetRoutes(string_view from, const vector<string_view>& to) const {
+    const Stop* from_stop = FindStop(from);
+    if (!from_stop) {
+        throw out_of_range("unknown stop");
+    }
+    vector<pair<string, vector<RouteItem>>> routes(to.size());
+    vector<size_t> missing;
+    vector<StopId> missing_stops;
+    vector<Graph::VertexId> targets;
+    for (size_t idx = 0; idx < to.size(); ++idx) {
+        const Stop* to_stop = FindStop(to[idx]);
+        if (!to_stop) {
+            throw out_of_range("unknown stop");
+        }
+        if (route_cache_) {
+            if (const auto cached = route_cache_->Find(from_stop->GetId(), to_stop->GetId())) {
+                routes[idx] = ComposeRoute(*cached);
+                continue;
+            }
+        }
+        missing.push_back(idx);
+        missing_stops.push_back(to_stop->GetId());
+        targets.push_back(to_stop->GetIndx().first);
+    }
+    if (missing.empty()) {
+        return routes;
+    }
+
+    auto found = routing_->router->FindRoutes(from_stop->GetIndx().first, targets, true);
+    for (size_t i = 0; i < missing.size(); ++i) {
+        RouteCache::Value route;
+        if (found[i]) {
+            route.items = MakeRouteItems(found[i]->edges);
+            route.overlay = reoute_renderer->RenderRouteOverlay(route.items);
+        }
+        routes[missing[i]] = ComposeRoute(route);
+        if (route_cache_) {
+            route_cache_->Insert(from_stop->GetId(), missing_stops[i], make_shared<const RouteCache::Value>(move(route)));
+        }
+    }
+    return routes;
+}
+
+RouteMatrix TransportManager::GetRouteMatrix(const vector<string_view>& from, const vector<string_view>& to, bool with_items) const {
+    const auto find_vertex = [this](string_view stop_name) {
+        const Stop* stop = FindStop(stop_name);
+        if (!stop) {
+            throw out_of_range("unknown stop");
+        }
+        return static_cast<Graph::VertexId>(stop->GetIndx().first);
+    };
+    vector<Graph::VertexId> targets;
+    targets.reserve(to.size());
+    for (const auto stop_name : to) {
+        targets.push_back(find_vertex(stop_name));
+    }
+
+    RouteMatrix matrix;
+    matrix.times.reserve(from.size());
+    for (const auto stop_name : from) {
+        const auto found = routing_->router->FindRoutes(find_vertex(stop_name), targets, with_items);
+        auto& times = matrix.times.emplace_back();
+        times.reserve(found.size());
+        for (const auto& route : found) {
+            times.push_back(route ? optional<double>(route->weight) : nullopt);
+        }
+        if (with_items) {
+            auto& items = matrix.items.emplace_back();
+            items.reserve(found.size());
+            for (const auto& route : found) {
+                items.push_back(route ? MakeRouteItems(route->edges) : vector<RouteItem>());
+            }
+        }
+    }
+    return matrix;
+}
+
+pair<string, vector<vector<RouteItem>>> TransportManager::GetAlternativeRoutes(string_view from, string_view to, size_t count) const {
+    const Stop* from_stop = FindStop(from);
+    const Stop* to_stop = FindStop(to);
+    if (!from_stop || !to_stop) {
+        throw out_of_range("unknown stop");
+    }
+    vector<vector<RouteItem>> routes;
+    routing_->alternative_router->FindRoutes(
+        from_stop->GetIndx().first, to_stop->GetIndx().first, count, count * ROUTES_SEARCHED_PER_ALTERNATIVE,
+        [&](const vector<Graph::EdgeId>& edges) {
+            auto items = MakeRouteItems(edges);
+            const RouteItem* last_ride = nullptr;
+            for (const auto& item : items) {
+                if (item.type != RouteItemType::BUS) {
+                    continue;
                 }
+                // A roundtrip bus is boarded again at its last stop to go on.
+                if (last_ride && item.bus == last_ride->bus && item.span_start == last_ride->span_start + last_ride->span_count) {
+                    return false;
+                }
+                last_ride = &item;
             }
+            routes.push_back(move(items));
+            return true;
+        });
+    if (routes.empty()) {
+        return {};
+    }
+    return { reoute_renderer->RenderRoutes(routes), move(routes) };
+}
+
+vector<ParetoRoute> TransportManager::GetParetoRoutes(string_view from, string_view to) const {
+    const Stop* from_stop = FindStop(from);
+    const Stop* to_stop = FindStop(to);
+    if (!from_stop || !to_stop) {
+        throw out_of_range("unknown stop");
+    }
+    vector<ParetoRoute> routes;
+    for (const auto& route : routing_->pareto_router->FindRoutes(from_stop->GetIndx().first, to_stop->GetIndx().first)) {
+        // Every bus is boarded through a WAIT edge, so the first boarding is no transfer.
+        routes.push_back({ route.weight, route.count > 0 ? route.count - 1 : 0, MakeRouteItems(route.edges) });
+    }
+    return routes;
+}
+
+vector<ReachableStop> TransportManager::GetReachableStops(string_view from, double max_time) const {
+    const Stop* from_stop = FindStop(from);
+    if (!from_stop) {
+        throw out_of_range("unknown stop");
+    }
+    vector<ReachableStop> reachable_stops;
+    for (const auto& [vertex, time] : routing_->router->FindReachable(from_stop->GetIndx().first, max_time)) {
+        // Stops arrive at their even vertices; the rest are boarding and ride vertices.
+        if (vertex % 2 == 0 && vertex / 2 < declared_stops_.size()) {
+            reachable_stops.push_back({ stops_[declared_stops_[vertex / 2]].get(), time });
         }
     }
-    router = make_unique<Graph::Router<double>>(graph);
+    sort(reachable_stops.begin(), reachable_stops.end(), [](const ReachableStop& lhs, const ReachableStop& rhs) {
+        return make_pair(lhs.time, lhs.stop->GetName()) < make_pair(rhs.time, rhs.stop->GetName());
+    });
+    return reachable_stops;
 }
 
-pair<string, vector<Graph::Edge<double>>> TransportManager::GetRoute(const string& from, const string& to) const {
-    vector<Graph::Edge<double>> items;
-    const auto& info = router->BuildRoute(stops_.at(from)->GetIndx().first, stops_.at(to)->GetIndx().first);
-    if (!info.has_value())
+RouteCache::Value TransportManager::BuildRoute(const Stop& from, const Stop& to) const {
+    // Reused by every query of the thread, so only the items are allocated.
+    thread_local vector<Graph::EdgeId> edges;
+    if (!routing_->router->FindRouteEdges(from.GetIndx().first, to.GetIndx().first, edges)) {
         return {};
-    for (int i = 0; i < info->edge_count; ++i)
-        items.push_back(graph_->GetEdge(router->GetRouteEdge(info->id, i)));
-    //router->ReleaseRoute(info->id);
-    return { reoute_renderer->RenderRoute(items), items };
+    }
+    auto items = MakeRouteItems(edges);
+    return { reoute_renderer->RenderRouteOverlay(items), move(items) };
 }
 
+pair<string, vector<RouteItem>> TransportManager::ComposeRoute(const RouteCache::Value& route) const {
+    if (!route.overlay) {
+        return {};
+    }
+    return { reoute_renderer->ComposeMap(*route.overlay), route.items };
+}
 
-Svg::Color ReadColor(const Json::Node& json_color) {
+vector<RouteItem> TransportManager::MakeRouteItems(const vector<Graph::EdgeId>& edges) const {
+    vector<RouteItem> items;
+    const auto& edges_info = routing_->edges_info;
+    size_t boarding_position = 0;
+    for (const Graph::EdgeId edge_id : edges) {
+        const uint32_t owner = edges_info.owners[edge_id];
+        const uint32_t span_start = edges_info.span_starts[edge_id];
+        switch (edges_info.types[edge_id]) {
+        case RouteEdgeType::WAIT:
+            items.push_back({ RouteItemType::WAIT, stops_[owner]->GetName(), static_cast<double>(bus_wait_time_), 0, nullptr, 0, stops_[owner].get() });
+            break;
+        case RouteEdgeType::BUS:
+            items.push_back(MakeBusItem(owner, span_start, edges_info.span_counts[edge_id]));
+            break;
+        case RouteEdgeType::BOARD:
+            boarding_position = span_start;
+            break;
+        case RouteEdgeType::ALIGHT:
+            items.push_back(MakeBusItem(owner, boarding_position, span_start - boarding_position));
+            break;
+        default:
+            break;
+        }
+    }
+    return items;
+}
+
+
+Svg::Color ReadColor(const Json::View::Node& json_color) {
     try {
         const auto& color = json_color.AsArray();
         Svg::Rgb rgb;
@@ -198,12 +1216,93 @@ Svg::Color ReadColor(const Json::Node& json_color) {
         return Svg::Color(rgb);
     }
     catch (...) {
-        return Svg::Color(json_color.AsString());
+        return Svg::Color(string(json_color.AsString()));
     }
 
 }
 
-Map::Map::Map(const std::map<std::string, Json::Node>& json_properties, const TransportManager& manager) : manager(manager) {
+void SaveColor(Snapshot::Writer& writer, const Svg::Color& color) {
+    const auto* value = color.GetColor();
+    if (const auto* name = get_if<string>(value)) {
+        writer.Write<uint8_t>(0);
+        writer.WriteString(*name);
+        return;
+    }
+    const auto& rgb = get<Svg::Rgb>(*value);
+    writer.Write<uint8_t>(1);
+    writer.Write<uint64_t>(rgb.red);
+    writer.Write<uint64_t>(rgb.green);
+    writer.Write<uint64_t>(rgb.blue);
+    writer.Write<uint8_t>(rgb.alpha.has_value());
+    writer.Write(rgb.alpha.value_or(0.0));
+}
+
+Svg::Color LoadColor(Snapshot::Reader& reader) {
+    if (reader.Read<uint8_t>() == 0) {
+        return Svg::Color(string(reader.ReadString()));
+    }
+    Svg::Rgb rgb;
+    rgb.red = reader.Read<uint64_t>();
+    rgb.green = reader.Read<uint64_t>();
+    rgb.blue = reader.Read<uint64_t>();
+    const bool has_alpha = reader.Read<uint8_t>();
+    const double alpha = reader.Read<double>();
+    if (has_alpha) {
+        rgb.alpha.emplace(alpha);
+    }
+    return Svg::Color(rgb);
+}
+
+Map::Map::Map(Snapshot::Reader& reader) {
+    properties.width = reader.Read<double>();
+    properties.height = reader.Read<double>();
+    properties.padding = reader.Read<double>();
+    properties.stop_radius = reader.Read<double>();
+    properties.line_width = reader.Read<double>();
+    properties.stop_label_font_size = reader.Read<uint64_t>();
+    properties.stop_label_offset = reader.Read<Svg::Point>();
+    properties.underlayer_color = LoadColor(reader);
+    properties.underlayer_width = reader.Read<double>();
+    properties.color_palette.resize(reader.Read<uint64_t>());
+    for (auto& color : properties.color_palette) {
+        color = LoadColor(reader);
+    }
+    properties.bus_label_font_size = reader.Read<uint64_t>();
+    properties.bus_label_offset = reader.Read<Svg::Point>();
+    properties.layers = reader.ReadVector<LayerType>();
+    properties.outer_margin = reader.Read<double>();
+    stops_coodinates = reader.ReadVector<Coordinate>();
+    bus_colors = reader.ReadVector<size_t>();
+    if (!bus_colors.empty() && properties.color_palette.empty()) {
+        throw runtime_error("snapshot: inconsistent map");
+    }
+    map = string(reader.ReadString());
+}
+
+void Map::Map::Save(Snapshot::Writer& writer) const {
+    writer.Write(properties.width);
+    writer.Write(properties.height);
+    writer.Write(properties.padding);
+    writer.Write(properties.stop_radius);
+    writer.Write(properties.line_width);
+    writer.Write<uint64_t>(properties.stop_label_font_size);
+    writer.Write(properties.stop_label_offset);
+    SaveColor(writer, properties.underlayer_color);
+    writer.Write(properties.underlayer_width);
+    writer.Write<uint64_t>(properties.color_palette.size());
+    for (const auto& color : properties.color_palette) {
+        SaveColor(writer, color);
+    }
+    writer.Write<uint64_t>(properties.bus_label_font_size);
+    writer.Write(properties.bus_label_offset);
+    writer.WriteVector(properties.layers);
+    writer.Write(properties.outer_margin);
+    writer.WriteVector(stops_coodinates);
+    writer.WriteVector(bus_colors);
+    writer.WriteString(map);
+}
+
+Map::Map::Map(const Json::View::Object& json_properties, const TransportManager& manager) {
     properties.width = json_properties.at("width").AsNumber();
     properties.height = json_properties.at("height").AsNumber();
     properties.padding = json_properties.at("padding").AsNumber();
@@ -232,28 +1331,44 @@ Map::Map::Map(const std::map<std::string, Json::Node>& json_properties, const Tr
     for (const auto& layer : layers) {
         properties.layers.push_back(STR_TO_LAYER_TYPE.at(layer.AsString()));
     }
-    ComputeStopsCoordinates();
+    ComputeStopsCoordinates(manager);
+    RenderMap(manager);
+}
+
+vector<StopId> Map::Map::GetSortedStops(const TransportManager& manager) const {
+    vector<StopId> stops;
+    for (const auto& stop : manager.GetStops())
+        if (stop) stops.push_back(stop->GetId());
+    sort(stops.begin(), stops.end(), [&manager](StopId lhs, StopId rhs) {
+        return manager.GetStop(lhs)->GetName() < manager.GetStop(rhs)->GetName();
+    });
+    return stops;
 }
 
-const unordered_map<string, unique_ptr<Bus>>& Map::Map::GetBuses() const { return manager.GetBuses(); }
+vector<BusId> Map::Map::GetSortedBuses(const TransportManager& manager) const {
+    vector<BusId> buses;
+    for (const auto& bus : manager.GetBuses())
+        buses.push_back(bus->GetId());
+    sort(buses.begin(), buses.end(), [&manager](BusId lhs, BusId rhs) {
+        return manager.GetBus(lhs)->GetName() < manager.GetBus(rhs)->GetName();
+    });
+    return buses;
+}
 
-void Map::Map::AddRounds() {
-    const auto& buses = manager.GetBuses();
-    set<string_view> bus_names;
-    for (const auto& bus : buses)
-        bus_names.insert(bus.first);
+void Map::Map::AddRounds(const TransportManager& manager) {
+    bus_colors.assign(manager.GetBuses().size(), 0);
     size_t bus_num = 0;
-    for (const auto& bus_name : bus_names) {
-        const auto* bus = manager.GetBus(string(bus_name));
+    for (const BusId bus_id : GetSortedBuses(manager)) {
+        const auto* bus = manager.GetBus(bus_id);
         const auto& stops = bus->GetStops();
         Svg::Polyline round;
-        bus_colors[bus_name] = bus_num;
+        bus_colors[bus_id] = bus_num;
         round.SetStrokeColor(properties.color_palette.at(bus_num % (properties.color_palette.size())))
             .SetStrokeWidth(properties.line_width)
             .SetStrokeLineCap("round")
             .SetStrokeLineJoin("round");
-        for (const auto& stop_name : stops) {
-            const auto& stop_coord = stops_coodinates.at(stop_name);
+        for (const StopId stop : stops) {
+            const auto& stop_coord = stops_coodinates.at(stop);
             round.AddPoint({
                     stop_coord.longitude,
                     stop_coord.latitude
@@ -273,14 +1388,11 @@ void Map::Map::AddRounds() {
     }
 }
 
-void Map::Map::AddBusNames() {
-    const auto& buses = manager.GetBuses();
-    set<string_view> bus_names;
-    for (const auto& bus : buses)
-        bus_names.insert(bus.first);
+void Map::Map::AddBusNames(const TransportManager& manager) {
     size_t bus_num = 0;
-    for (const auto& bus_name : bus_names) {
-        const auto* bus = manager.GetBus(string(bus_name));
+    for (const BusId bus_id : GetSortedBuses(manager)) {
+        const auto* bus = manager.GetBus(bus_id);
+        const string_view bus_name = bus->GetName();
         const auto& stops = bus->GetStops();
         const auto& stop_coord = stops_coodinates.at(stops.front());
         svg.Add(Svg::Text{}
@@ -342,13 +1454,9 @@ void Map::Map::AddBusNames() {
     }
 }
 
-void Map::Map::AddStops() {
-    const auto& stops = manager.GetStops();
-    set<string_view> stop_names;
-    for (const auto& stop : stops)
-        stop_names.insert(stop.first);
-    for (const auto& stop_name : stop_names) {
-        const auto& stop_coord = stops_coodinates.at(stop_name);
+void Map::Map::AddStops(const TransportManager& manager) {
+    for (const StopId stop : GetSortedStops(manager)) {
+        const auto& stop_coord = stops_coodinates.at(stop);
         svg.Add(Svg::Circle{}
             .SetCenter({
                     stop_coord.longitude,
@@ -359,13 +1467,10 @@ void Map::Map::AddStops() {
     }
 }
 
-void Map::Map::AddNames() {
-    const auto& stops = manager.GetStops();
-    set<string_view> stop_names;
-    for (const auto& stop : stops)
-        stop_names.insert(stop.first);
-    for (const auto& stop_name : stop_names) {
-        const auto& stop_coord = stops_coodinates.at(stop_name);
+void Map::Map::AddNames(const TransportManager& manager) {
+    for (const StopId stop : GetSortedStops(manager)) {
+        const string_view stop_name = manager.GetStop(stop)->GetName();
+        const auto& stop_coord = stops_coodinates.at(stop);
         svg.Add(Svg::Text{}
             .SetPoint({
                     stop_coord.longitude,
@@ -393,50 +1498,47 @@ void Map::Map::AddNames() {
     }
 }
 
-void Map::Map::ComputeNearbyStops() {
-    for (const auto& [bus_name, bus] : manager.GetBuses()) {
+void Map::Map::ComputeNearbyStops(const TransportManager& manager) {
+    nearby_stops.assign(manager.GetStops().size(), {});
+    for (const auto& bus : manager.GetBuses()) {
         const auto& stops = bus->GetStops();
         for (size_t i = 1; i < stops.size(); ++i) {
-            nearby_stops[stops[i]].insert(stops[i - 1]);
-            nearby_stops[stops[i - 1]].insert(stops[i]);
+            nearby_stops[stops[i]].push_back(stops[i - 1]);
+            nearby_stops[stops[i - 1]].push_back(stops[i]);
         }
     }
-}
-
-bool Map::Map::FindNearby(string_view first, string_view second) const {
-    if (nearby_stops.count(first)) {
-        return (nearby_stops.count(first) && nearby_stops.at(first).count(second)) ||
-            (nearby_stops.count(second) && nearby_stops.at(second).count(first));
+    for (auto& neighbours : nearby_stops) {
+        sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(unique(neighbours.begin(), neighbours.end()), neighbours.end());
     }
-    return false;
 }
 
-optional<size_t> Map::Map::IsNearby(const vector<StopPosition>& coordinates, const vector<size_t>& indeces, size_t coordinate_num) const {
-    const auto& buses = manager.GetBuses();
+// Stops adjacent on some route always share that bus, so only the neighbours
+// of the stop that come earlier in the sorted order have to be looked at.
+optional<size_t> Map::Map::IsNearby(const vector<StopPosition>& coordinates, const vector<size_t>& positions,
+                                    const vector<size_t>& indeces, size_t coordinate_num) const {
     optional<size_t> max_idx;
-    string_view stop_name = coordinates[coordinate_num].name;
-    for (size_t i = 0; i < coordinate_num; ++i) {
-        string_view cmp = coordinates[i].name;
-        for (const auto& [bus_name, bus] : manager.GetBuses()) {
-            if (bus->Find(cmp)
-                && bus->Find(stop_name)) {
-                if (FindNearby(stop_name, cmp)) {
-                    if (max_idx.has_value()) {
-                        max_idx = max(max_idx.value(), indeces[i]);
-                    }
-                    else max_idx = indeces[i];
-                }
-            }
+    for (const StopId neighbour : nearby_stops[coordinates[coordinate_num].stop]) {
+        const size_t position = positions[neighbour];
+        if (position >= coordinate_num) {
+            continue;
+        }
+        if (max_idx.has_value()) {
+            max_idx = max(max_idx.value(), indeces[position]);
         }
+        else max_idx = indeces[position];
     }
     return max_idx;
 }
 
-vector<list<size_t>> Map::Map::Paginator(vector<StopPosition> coordinates) const {
+vector<list<size_t>> Map::Map::Paginator(const TransportManager& manager, vector<StopPosition> coordinates) const {
+    vector<size_t> positions(manager.GetStops().size(), coordinates.size());
+    for (size_t i = 0; i < coordinates.size(); ++i)
+        positions[coordinates[i].stop] = i;
     vector<size_t> indeces(coordinates.size());
     indeces.front() = 0;
     for (size_t i = 1; i < coordinates.size(); ++i) {
-        auto is_nearby = IsNearby(coordinates,
+        auto is_nearby = IsNearby(coordinates, positions,
             indeces, i);
         if (is_nearby.has_value())
             indeces[i] = is_nearby.value() + 1;
@@ -453,43 +1555,42 @@ vector<list<size_t>> Map::Map::Paginator(vector<StopPosition> coordinates) const
     sort(coordinates.begin(), coordinates.end(), [](const StopPosition& lhs, const StopPosition& rhs) {         \
         return lhs.coordinate.axis < rhs.coordinate.axis;                                                       \
     });                                                                                                         \
-    __ranges__ = Paginator(coordinates);                                                                        \
+    __ranges__ = Paginator(manager, coordinates);                                                               \
     for (size_t idx = 0; idx < __ranges__.size(); idx++)                                                        \
         for (size_t position : __ranges__[idx])                                                                 \
             coordinates[position].idx.axis = idx;                                                               \
 }
 
-void Map::Map::FindBaseStops(vector<StopPosition>& coordinates) const {
+void Map::Map::FindBaseStops(const TransportManager& manager, vector<StopPosition>& coordinates) const {
     for (auto& coordinate : coordinates) {
         size_t buses_counter = 0;
-        string_view stop_name = coordinate.name;
-        for (const auto& [bus_name, bus] : manager.GetBuses()) {
-            if (bus->Find(stop_name)) {
-                size_t counter = 0;
-                for (const auto& stop : bus->GetStops())
-                    if (stop == stop_name) counter++;
-                if (bus->IsReversed() && counter > 1) coordinate.is_base = true;
-                if (!bus->IsReversed() && counter > 2) coordinate.is_base = true;
-                buses_counter++;
-                auto& route = bus->GetStops();
-                if (route.front() == stop_name) coordinate.is_base = true;
-                if (bus->IsReversed() && (route.front() != route.back()) && route.back() == stop_name) coordinate.is_base = true;
-            }
+        const StopId stop_id = coordinate.stop;
+        for (const BusId bus_id : manager.GetStopBuses(stop_id)) {
+            const Bus* bus = manager.GetBus(bus_id);
+            size_t counter = 0;
+            for (const StopId stop : bus->GetStops())
+                if (stop == stop_id) counter++;
+            if (bus->IsReversed() && counter > 1) coordinate.is_base = true;
+            if (!bus->IsReversed() && counter > 2) coordinate.is_base = true;
+            buses_counter++;
+            auto& route = bus->GetStops();
+            if (route.front() == stop_id) coordinate.is_base = true;
+            if (bus->IsReversed() && (route.front() != route.back()) && route.back() == stop_id) coordinate.is_base = true;
         }
         if (buses_counter != 1) coordinate.is_base = true;
     }
 }
 
-void Map::Map::Interpolation(vector<StopPosition>& coordinates) const {
-    FindBaseStops(coordinates);
-    unordered_map<string_view, StopPosition*> coordinates_map;
+void Map::Map::Interpolation(const TransportManager& manager, vector<StopPosition>& coordinates) const {
+    FindBaseStops(manager, coordinates);
+    vector<StopPosition*> coordinates_map(manager.GetStops().size(), nullptr);
     for (auto& coordinate : coordinates)
-        coordinates_map[coordinate.name] = &coordinate;
+        coordinates_map[coordinate.stop] = &coordinate;
 
-    for (const auto& [bus_name, bus] : manager.GetBuses()) {
+    for (const auto& bus : manager.GetBuses()) {
         auto& stops = bus->GetStops();
         size_t i = 0, j = 0;
-        for (const auto& stop : stops) {
+        for (const StopId stop : stops) {
             if (coordinates_map[stop]->is_base && i != j) {
                 double lon_step = (coordinates_map[stops[j]]->coordinate.longitude - coordinates_map[stops[i]]->coordinate.longitude) / (j - i);
                 for (size_t k = i + 1; k < j; ++k) {
@@ -506,18 +1607,24 @@ void Map::Map::Interpolation(vector<StopPosition>& coordinates) const {
     }
 }
 
-void Map::Map::ComputeStopsCoordinates() {
-    ComputeNearbyStops();
+void Map::Map::ComputeStopsCoordinates(const TransportManager& manager) {
+    ComputeNearbyStops(manager);
     const auto& stops = manager.GetStops();
     vector<StopPosition> coordinates;
     coordinates.reserve(stops.size());
-    for (const auto& stop : stops)
-        coordinates.push_back({ stop.first, stop.second->GetCoordinate() });
-    Interpolation(coordinates);
+    // Stops enter the layout in the order of a hash map of names filled in
+    // declaration order, as when the manager kept its stops in one.
+    unordered_map<string_view, StopId> stops_by_name;
+    for (const StopId stop : manager.GetDeclaredStops())
+        stops_by_name.emplace(manager.GetStop(stop)->GetName(), stop);
+    for (const auto& [name, stop] : stops_by_name)
+        coordinates.push_back({ stop, manager.GetStop(stop)->GetCoordinate() });
+    Interpolation(manager, coordinates);
     if (!coordinates.size()) return;
+    stops_coodinates.assign(stops.size(), {});
     if (coordinates.size() == 1) {
-        stops_coodinates[coordinates.front().name].longitude = properties.padding;
-        stops_coodinates[coordinates.front().name].latitude = properties.height - properties.padding;
+        stops_coodinates[coordinates.front().stop].longitude = properties.padding;
+        stops_coodinates[coordinates.front().stop].latitude = properties.height - properties.padding;
         return;
     }
 
@@ -537,27 +1644,26 @@ void Map::Map::ComputeStopsCoordinates() {
         coordinate.coordinate.latitude = properties.height - properties.padding - y_step * coordinate.idx.latitude;
 
     for (const auto& coordinate : coordinates)
-        stops_coodinates[coordinate.name] = coordinate.coordinate;
+        stops_coodinates[coordinate.stop] = coordinate.coordinate;
 }
 
-void Map::Map::RenderMap() {
-    if (is_rendered) return;
+void Map::Map::RenderMap(const TransportManager& manager) {
     for (auto layer : properties.layers) {
         switch (layer) {
         case LayerType::BUS_LABELS: {
-            AddBusNames();
+            AddBusNames(manager);
             break;
         }
         case LayerType::BUS_LINES: {
-            AddRounds();
+            AddRounds(manager);
             break;
         }
         case LayerType::STOP_LABELS: {
-            AddNames();
+            AddNames(manager);
             break;
         }
         case LayerType::STOP_POINTS: {
-            AddStops();
+            AddStops(manager);
             break;
         }
         default: break;
@@ -568,15 +1674,27 @@ void Map::Map::RenderMap() {
     stringstream result;
     result << quoted(out.str());
     map = result.str();
-    is_rendered = true;
 }
 
 namespace Map {
+    // Escapes text as quoted does, without the enclosing quotes.
+    string Escape(string_view text) {
+        string result;
+        result.reserve(text.size() + text.size() / 8);
+        for (const char c : text) {
+            if (c == '"' || c == '\\') {
+                result.push_back('\\');
+            }
+            result.push_back(c);
+        }
+        return result;
+    }
+
     RouteRenderer::RouteRenderer(shared_ptr<Map> map) : map(map) {
-        map->RenderMap();
         const auto& properties = map->GetProperties();
-        base_svg = map->GetSvgMap();
-        base_svg.Add(Svg::Rectangle{}
+        // The underlayer goes into its own document, so the map is not copied.
+        Svg::Document underlayer;
+        underlayer.Add(Svg::Rectangle{}
             .SetFirstPoint({
                 -properties.outer_margin,
                 -properties.outer_margin
@@ -587,80 +1705,147 @@ namespace Map {
                 })
             .SetFillColor(properties.underlayer_color)
         );
-        base_size = base_svg.Size();
+        stringstream out;
+        Svg::Document::RenderHeader(out);
+        map->GetSvgMap().RenderObjects(out);
+        underlayer.RenderObjects(out);
+        quoted_prefix = '"' + Escape(out.str());
+        SetQuotedFooter();
+    }
+
+    RouteRenderer::RouteRenderer(shared_ptr<Map> map, Snapshot::Reader& reader)
+        : map(map), quoted_prefix(reader.ReadString()) {
+        SetQuotedFooter();
+    }
+
+    void RouteRenderer::Save(Snapshot::Writer& writer) const {
+        writer.WriteString(quoted_prefix);
+    }
+
+    void RouteRenderer::SetQuotedFooter() {
+        stringstream out;
+        Svg::Document::RenderFooter(out);
+        quoted_footer = Escape(out.str()) + '"';
+    }
+
+    void RouteRenderer::AddLayer(LayerType layer, const vector<RouteItem>& items, Svg::Document& svg) const {
+        switch (layer) {
+        case LayerType::BUS_LABELS: {
+            AddBusNames(items, svg);
+            break;
+        }
+        case LayerType::BUS_LINES: {
+            AddRounds(items, svg);
+            break;
+        }
+        case LayerType::STOP_LABELS: {
+            AddNames(items, svg);
+            break;
+        }
+        case LayerType::STOP_POINTS: {
+            AddStops(items, svg);
+            break;
+        }
+        default: break;
+        }
+    }
+
+    string RouteRenderer::EscapeObjects(const Svg::Document& overlay) {
+        stringstream out;
+        overlay.RenderObjects(out);
+        return Escape(out.str());
     }
 
-    string RouteRenderer::RenderRoute(const vector<Graph::Edge<double>>& items) {
+    string RouteRenderer::RenderOverlay(const Svg::Document& overlay) const {
+        return ComposeMap(EscapeObjects(overlay));
+    }
+
+    string RouteRenderer::ComposeMap(string_view overlay) const {
+        string result;
+        result.reserve(quoted_prefix.size() + overlay.size() + quoted_footer.size());
+        result += quoted_prefix;
+        result += overlay;
+        result += quoted_footer;
+        return result;
+    }
+
+    string RouteRenderer::RenderRouteOverlay(const vector<RouteItem>& items) const {
+        Svg::Document route_svg;
         for (auto layer : map->GetProperties().layers) {
-            switch (layer) {
-            case LayerType::BUS_LABELS: {
-                AddBusNames(items);
-                break;
-            }
-            case LayerType::BUS_LINES: {
-                AddRounds(items);
-                break;
-            }
-            case LayerType::STOP_LABELS: {
-                AddNames(items);
-                break;
-            }
-            case LayerType::STOP_POINTS: {
-                AddStops(items);
-                break;
-            }
-            default: break;
+            AddLayer(layer, items, route_svg);
+        }
+        return EscapeObjects(route_svg);
+    }
+
+    string RouteRenderer::RenderRoute(const vector<RouteItem>& items) const {
+        return ComposeMap(RenderRouteOverlay(items));
+    }
+
+    string RouteRenderer::RenderRoutes(const vector<vector<RouteItem>>& routes) const {
+        Svg::Document routes_svg;
+        for (auto layer : map->GetProperties().layers) {
+            for (auto it = routes.rbegin(); it != routes.rend(); ++it) {
+                AddLayer(layer, *it, routes_svg);
             }
         }
-        stringstream out;
-        base_svg.Render(out);
-        base_svg.Remove(base_size);
-        stringstream result;
-        result << quoted(out.str());
-        return result.str();
+        return RenderOverlay(routes_svg);
     }
 
-    void RouteRenderer::AddRounds(const vector<Graph::Edge<double>>& items) {
+    string RouteRenderer::RenderReachableStops(const vector<ReachableStop>& stops, double max_time) const {
+        const auto& properties = map->GetProperties();
+        const auto& stops_coordinates = map->GetCoordinates();
+        Svg::Document overlay;
+        for (const auto& reachable : stops) {
+            const double share = max_time > 0 ? min(reachable.time / max_time, 1.0) : 0.0;
+            const auto& stop_coord = stops_coordinates.at(reachable.stop->GetId());
+            overlay.Add(Svg::Circle{}
+                .SetCenter({
+                        stop_coord.longitude,
+                        stop_coord.latitude
+                    })
+                .SetRadius(properties.stop_radius)
+                .SetFillColor(Svg::Rgb(lround(255 * share), lround(255 * (1 - share)), 0)));
+        }
+        return RenderOverlay(overlay);
+    }
+
+    void RouteRenderer::AddRounds(const vector<RouteItem>& items, Svg::Document& svg) const {
         const auto& properties = map->GetProperties();
         const auto& bus_colors = map->GetColors();
         const auto& stops_coordinates = map->GetCoordinates();
         for (const auto& item : items) {
-            if (item.type == "Wait") continue;
+            if (item.type == RouteItemType::WAIT) continue;
             Svg::Polyline round;
-            round.SetStrokeColor(properties.color_palette.at(bus_colors.at(item.text) % (properties.color_palette.size())))
+            round.SetStrokeColor(properties.color_palette.at(bus_colors.at(item.bus->GetId()) % (properties.color_palette.size())))
                 .SetStrokeWidth(properties.line_width)
                 .SetStrokeLineCap("round")
                 .SetStrokeLineJoin("round");
-            for (const auto& line : item.stops_list) {
-                const auto& stop_coord = stops_coordinates.at(line.first);
+            for (size_t position = item.span_start; position <= item.span_start + item.span_count; ++position) {
+                const auto& stop_coord = stops_coordinates.at(item.bus->GetRouteStop(position));
                 round.AddPoint({
                         stop_coord.longitude,
                         stop_coord.latitude
                     });
             }
-            const auto& stop_coord = stops_coordinates.at(item.stops_list.back().second);
-            round.AddPoint({
-                        stop_coord.longitude,
-                        stop_coord.latitude
-                });
-            base_svg.Add(round);
+            svg.Add(round);
         }
     }
 
-    void RouteRenderer::AddBusNames(const vector<Graph::Edge<double>>& items) {
+    void RouteRenderer::AddBusNames(const vector<RouteItem>& items, Svg::Document& svg) const {
         const auto& properties = map->GetProperties();
         const auto& bus_colors = map->GetColors();
         const auto& stops_coordinates = map->GetCoordinates();
         for (const auto& item : items) {
-            if (item.type == "Wait") continue;
-            const auto& buses = map->GetBuses();
+            if (item.type == RouteItemType::WAIT) continue;
+            const StopId first_stop = item.bus->GetRouteStop(item.span_start);
+            const StopId last_stop = item.bus->GetRouteStop(item.span_start + item.span_count);
             vector<Coordinate> ending_stops;
-            if (buses.at(item.text)->IsEnding(item.stops_list.front().first)) 
-                ending_stops.push_back(stops_coordinates.at(item.stops_list.front().first));
-            if (buses.at(item.text)->IsEnding(item.stops_list.back().second))
-                ending_stops.push_back(stops_coordinates.at(item.stops_list.back().second));
+            if (item.bus->IsEnding(first_stop))
+                ending_stops.push_back(stops_coordinates.at(first_stop));
+            if (item.bus->IsEnding(last_stop))
+                ending_stops.push_back(stops_coordinates.at(last_stop));
             for (const auto& stop_coord : ending_stops) {
-                base_svg.Add(Svg::Text{}
+                svg.Add(Svg::Text{}
                     .SetPoint({
                             stop_coord.longitude,
                             stop_coord.latitude
@@ -668,14 +1853,14 @@ namespace Map {
                     .SetOffset(properties.bus_label_offset)
                     .SetFontSize(properties.bus_label_font_size)
                     .SetFontFamily("Verdana")
-                    .SetData(item.text)
+                    .SetData(string(item.name))
                     .SetFillColor(properties.underlayer_color)
                     .SetStrokeColor(properties.underlayer_color)
                     .SetStrokeWidth(properties.underlayer_width)
                     .SetStrokeLineCap("round")
                     .SetFontWeight("bold")
                     .SetStrokeLineJoin("round"));
-                base_svg.Add(Svg::Text{}
+                svg.Add(Svg::Text{}
                     .SetPoint({
                             stop_coord.longitude,
                             stop_coord.latitude
@@ -684,21 +1869,20 @@ namespace Map {
                     .SetFontSize(properties.bus_label_font_size)
                     .SetFontFamily("Verdana")
                     .SetFontWeight("bold")
-                    .SetData(item.text)
-                    .SetFillColor(properties.color_palette.at(bus_colors.at(item.text) % (properties.color_palette.size()))));
+                    .SetData(string(item.name))
+                    .SetFillColor(properties.color_palette.at(bus_colors.at(item.bus->GetId()) % (properties.color_palette.size()))));
             }
         }
     }
 
-    void RouteRenderer::AddStops(const vector<Graph::Edge<double>>& items) {
+    void RouteRenderer::AddStops(const vector<RouteItem>& items, Svg::Document& svg) const {
         const auto& properties = map->GetProperties();
-        const auto& bus_colors = map->GetColors();
         const auto& stops_coordinates = map->GetCoordinates();
         for (const auto& item : items) {
-            if (item.type == "Wait") continue;
-            for (const auto& line : item.stops_list) {
-                const auto& stop_coord = stops_coordinates.at(line.first);
-                base_svg.Add(Svg::Circle{}
+            if (item.type == RouteItemType::WAIT) continue;
+            for (size_t position = item.span_start; position <= item.span_start + item.span_count; ++position) {
+                const auto& stop_coord = stops_coordinates.at(item.bus->GetRouteStop(position));
+                svg.Add(Svg::Circle{}
                     .SetCenter({
                             stop_coord.longitude,
                             stop_coord.latitude
@@ -706,35 +1890,23 @@ namespace Map {
                     .SetRadius(properties.stop_radius)
                     .SetFillColor("white"));
             }
-            const auto& stop_coord = stops_coordinates.at(item.stops_list.back().second);
-            base_svg.Add(Svg::Circle{}
-                .SetCenter({
-                        stop_coord.longitude,
-                        stop_coord.latitude
-                    })
-                .SetRadius(properties.stop_radius)
-                .SetFillColor("white"));
         }
     }
 
-    void RouteRenderer::AddNames(const vector<Graph::Edge<double>>& items) {
+    void RouteRenderer::AddNames(const vector<RouteItem>& items, Svg::Document& svg) const {
         size_t counter = 0;
         const auto& stops_coordinates = map->GetCoordinates();
         const auto& properties = map->GetProperties();
         for (const auto& item : items) {
             counter++;
-            Coordinate stop_coord;
-            string stop_name;
-            if (item.type == "Wait") {
-                stop_name = item.text;
-                stop_coord = stops_coordinates.at(item.text);
-            }
-            else if (counter == items.size()) {
-                stop_name = item.stops_list.back().second;
-                stop_coord = stops_coordinates.at(item.stops_list.back().second);
+            const Stop* stop = nullptr;
+            if (item.type == RouteItemType::WAIT || counter == items.size()) {
+                stop = item.stop;
             }
             else continue;
-            base_svg.Add(Svg::Text{}
+            const Coordinate& stop_coord = stops_coordinates.at(stop->GetId());
+            const string stop_name(stop->GetName());
+            svg.Add(Svg::Text{}
                 .SetPoint({
                         stop_coord.longitude,
                         stop_coord.latitude
@@ -748,7 +1920,7 @@ namespace Map {
                 .SetStrokeWidth(properties.underlayer_width)
                 .SetStrokeLineCap("round")
                 .SetStrokeLineJoin("round"));
-            base_svg.Add(Svg::Text{}
+            svg.Add(Svg::Text{}
                 .SetPoint({
                         stop_coord.longitude,
                         stop_coord.latitude
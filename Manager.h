@@ -10,6 +10,7 @@
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <sstream>
@@ -21,12 +22,20 @@
 #include <map>
 #include <iomanip>
 #include <list>
+#include <deque>
 #include <vector>
 #include <algorithm>
+#include <array>
 #include "graph.h"
-#include "Json.h"
+#include "JsonView.h"
 #include "router.h"
+#include "dijkstra_router.h"
+#include "contraction_router.h"
+#include "pareto_router.h"
+#include "yen_router.h"
+#include "raptor.h"
 #include "svg.h"
+#include "snapshot.h"
 
 using namespace std;
 
@@ -34,6 +43,86 @@ class TransportManager;
 class Bus;
 class Stop;
 
+using StopId = uint32_t;
+using BusId = uint32_t;
+
+// Gives names dense ids in the order they are first seen. Every name is stored
+// once and never moves, and copies of the interner share the stored names, so
+// views of a name stay valid for as long as any copy that has it lives.
+// Copies also share the table of names seen so far; names a copy adds go to
+// its own small table, which is folded into a new shared one once it holds
+// more than the square root of the shared table's size. A copy and the
+// amortized cost of adding a name thus stay well below the size of the table.
+class NameInterner {
+public:
+    uint32_t Intern(string_view name);
+
+    optional<uint32_t> Find(string_view name) const;
+
+    string_view GetName(uint32_t id) const {
+        return id < base_->names.size() ? *base_->names[id] : *added_names_[id - base_->names.size()];
+    }
+
+    size_t Size() const { return base_->names.size() + added_names_.size(); }
+
+    void Save(Snapshot::Writer& writer) const;
+
+    // Interns the names written by Save, which keep their ids.
+    void Load(Snapshot::Reader& reader);
+
+private:
+    struct Table {
+        vector<shared_ptr<const string>> names;
+        unordered_map<string_view, uint32_t> ids;
+    };
+
+    // Changed in place only while no other copy shares it.
+    shared_ptr<Table> base_ = make_shared<Table>();
+    // Names interned since base_ became shared; their ids follow its own.
+    vector<shared_ptr<const string>> added_names_;
+    unordered_map<string_view, uint32_t> added_ids_;
+
+    void Fold();
+};
+
+// Road distances keyed by stop ids. A distance given in one direction only
+// also serves the other one. Resolve packs both directions into a CSR table
+// with rows sorted by destination, so that a lookup is one probe of a short
+// row; until then, and after any later Set, lookups go to the given
+// distances and fall back to the reverse pair. Nothing here throws.
+class DistanceTable {
+public:
+    void Set(StopId from, StopId to, int distance);
+
+    optional<int> Get(StopId from, StopId to) const;
+
+    void Resolve();
+
+    bool IsResolved() const { return is_resolved_; }
+
+    void Save(Snapshot::Writer& writer) const;
+
+    // Replaces the table with one written by Save.
+    void Load(Snapshot::Reader& reader);
+
+private:
+    struct Entry {
+        StopId to;
+        int distance;
+    };
+
+    unordered_map<uint64_t, int> given_;
+    bool is_resolved_ = false;
+    vector<uint32_t> offsets_;
+    vector<Entry> entries_;
+
+    optional<int> FindGiven(StopId from, StopId to) const;
+
+    static uint64_t MakeKey(StopId from, StopId to) {
+        return (static_cast<uint64_t>(from) << 32) | to;
+    }
+};
+
 struct EdgeWeight {
     EdgeWeight() = default;
     EdgeWeight(int val) : time(val) {}
@@ -43,6 +132,136 @@ struct EdgeWeight {
     size_t stop_count = 0;
 };
 
+enum class RouteItemType : uint8_t {
+    WAIT,
+    BUS,
+};
+
+// One step of a built route. For a bus ride the span covers the stops
+// [span_start, span_start + span_count] of Bus::GetRouteStop and ends at
+// stop; a wait happens at stop.
+struct RouteItem {
+    RouteItemType type;
+    string_view name;
+    double time = 0;
+    size_t span_count = 0;
+    const Bus* bus = nullptr;
+    size_t span_start = 0;
+    const Stop* stop = nullptr;
+};
+
+// A stop found by TransportManager::GetReachableStops, with the travel time
+// to it in minutes.
+struct ReachableStop {
+    const Stop* stop = nullptr;
+    double time = 0;
+};
+
+// Answer to TransportManager::GetRouteMatrix, indexed by origin, then by
+// destination. Times are in minutes, nullopt where there is no route.
+struct RouteMatrix {
+    vector<vector<optional<double>>> times;
+    // Same shape as times when items were asked for, empty otherwise.
+    vector<vector<vector<RouteItem>>> items;
+};
+
+// One route of TransportManager::GetParetoRoutes: no other route is both
+// faster and has fewer transfers.
+struct ParetoRoute {
+    double time = 0;
+    size_t transfer_count = 0;
+    vector<RouteItem> items;
+};
+
+// Built routes with the SVG of their overlay, keyed by (from, to) stop ids and
+// bounded by an estimate of the bytes they hold. Keys are spread over shards,
+// each an LRU list behind its own mutex, so concurrent queries rarely wait on
+// each other. A cache belongs to one router and one map: TransportManager
+// drops it whenever either changes.
+class RouteCache {
+public:
+    // The route's own objects, rendered for RouteRenderer::ComposeMap, which
+    // adds the map they go over; nullopt when there is no route.
+    struct Value {
+        optional<string> overlay;
+        vector<RouteItem> items;
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+
+    explicit RouteCache(size_t capacity_bytes);
+
+    // Counts a hit or a miss.
+    shared_ptr<const Value> Find(StopId from, StopId to) const;
+
+    // Evicts the least recently used entries of the shard to make room; a
+    // value larger than a whole shard is not kept.
+    void Insert(StopId from, StopId to, shared_ptr<const Value> value) const;
+
+    Stats GetStats() const;
+
+private:
+    static constexpr size_t SHARD_COUNT = 16;
+    static_assert(SHARD_COUNT == 1 << 4);
+
+    struct Entry {
+        uint64_t key;
+        shared_ptr<const Value> value;
+        size_t bytes;
+    };
+
+    struct Shard {
+        mutex m;
+        // Most recently used first.
+        list<Entry> entries;
+        unordered_map<uint64_t, list<Entry>::iterator> index;
+        size_t bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+    size_t shard_capacity_;
+    mutable array<Shard, SHARD_COUNT> shards_;
+
+    static uint64_t MakeKey(StopId from, StopId to) {
+        return (static_cast<uint64_t>(from) << 32) | to;
+    }
+
+    Shard& GetShard(uint64_t key) const {
+        // Fibonacci hashing: the top bits of the product pick the shard.
+        return shards_[key * 0x9E3779B97F4A7C15ull >> 60];
+    }
+};
+
+// Problems found by TransportManager::Finalize. A route segment without a
+// road distance in either direction counts as zero metres.
+struct NetworkValidation {
+    struct MissingDistance {
+        BusId bus;
+        StopId from;
+        StopId to;
+    };
+
+    vector<MissingDistance> missing_distances;
+
+    bool IsValid() const { return missing_distances.empty(); }
+};
+
+// Answer to a bus query, computed once per bus by TransportManager::BuildBusStats.
+struct BusStats {
+    size_t stop_count = 0;
+    size_t unique_stop_count = 0;
+    int route_length = 0;
+    double curvature = 0;
+};
+
 struct Coordinate {
     double
         latitude = 0.0,
@@ -74,12 +293,17 @@ namespace Map {
         double outer_margin;
     };
 
+    // Laid out and rendered from the manager on construction. The map keeps
+    // no reference to it, so later versions of the manager can share the map.
     class Map {
     public:
         Map() = delete;
-        Map(const std::map<std::string, Json::Node>&, const TransportManager&);
+        Map(const Json::View::Object&, const TransportManager& manager);
+        // Restores a rendered map written by Save. Its svg document stays
+        // empty: only the rendered text and the layout are kept.
+        explicit Map(Snapshot::Reader& reader);
 
-        void RenderMap();
+        void Save(Snapshot::Writer& writer) const;
 
         const Properties& GetProperties() const { return properties; }
 
@@ -91,11 +315,7 @@ namespace Map {
 
         const Svg::Document& GetSvgMap() const { return svg; }
 
-        const unordered_map<string, unique_ptr<Bus>>& GetBuses() const;
-
     private:
-        bool is_rendered = false;
-
         const unordered_map<string_view, LayerType> STR_TO_LAYER_TYPE = {
             {"bus_lines", LayerType::BUS_LINES},
             {"bus_labels", LayerType::BUS_LABELS},
@@ -103,18 +323,18 @@ namespace Map {
             {"stop_labels", LayerType::STOP_LABELS},
         };
 
-        const TransportManager& manager;
         Svg::Document svg;
         string map = "";
 
         Properties properties;
 
-        unordered_map<string_view, Coordinate> stops_coodinates;
-        unordered_map<string_view, unordered_set<string_view>> nearby_stops;
-        unordered_map<string_view, size_t> bus_colors;
+        // Indexed by StopId and BusId.
+        vector<Coordinate> stops_coodinates;
+        vector<vector<StopId>> nearby_stops;
+        vector<size_t> bus_colors;
 
         struct StopPosition {
-            string_view name;
+            StopId stop;
             Coordinate coordinate;
             struct Indexes {
                 size_t longitude = 0;
@@ -123,19 +343,22 @@ namespace Map {
             bool is_base = false;
         };
 
-        void ComputeStopsCoordinates();
-        void ComputeNearbyStops();
+        void ComputeStopsCoordinates(const TransportManager& manager);
+        void ComputeNearbyStops(const TransportManager& manager);
+        void RenderMap(const TransportManager& manager);
 
-        bool FindNearby(string_view first, string_view second) const;
+        vector<StopId> GetSortedStops(const TransportManager& manager) const;
+        vector<BusId> GetSortedBuses(const TransportManager& manager) const;
 
-        void AddRounds();
-        void AddStops();
-        void AddNames();
-        void AddBusNames();
-        optional<size_t> IsNearby(const vector<StopPosition>& coordinates, const vector<size_t>& idx_range, size_t coodinate_num) const;
-        vector<list<size_t>> Paginator(vector<StopPosition> coordinates) const;
-        void FindBaseStops(vector<StopPosition>& coordinates) const;
-        void Interpolation(vector<StopPosition>& coordinates) const;
+        void AddRounds(const TransportManager& manager);
+        void AddStops(const TransportManager& manager);
+        void AddNames(const TransportManager& manager);
+        void AddBusNames(const TransportManager& manager);
+        optional<size_t> IsNearby(const vector<StopPosition>& coordinates, const vector<size_t>& positions,
+                                  const vector<size_t>& idx_range, size_t coodinate_num) const;
+        vector<list<size_t>> Paginator(const TransportManager& manager, vector<StopPosition> coordinates) const;
+        void FindBaseStops(const TransportManager& manager, vector<StopPosition>& coordinates) const;
+        void Interpolation(const TransportManager& manager, vector<StopPosition>& coordinates) const;
 
     };
 }
@@ -146,63 +369,208 @@ namespace Map {
         RouteRenderer() = delete;
 
         RouteRenderer(shared_ptr<Map> map);
+        // Restores the base prefix written by Save instead of rendering it.
+        RouteRenderer(shared_ptr<Map> map, Snapshot::Reader& reader);
+
+        void Save(Snapshot::Writer& writer) const;
 
-        void AddRounds(const vector<Graph::Edge<double>>& items);
+        void AddRounds(const vector<RouteItem>& items, Svg::Document& svg) const;
 
-        void AddBusNames(const vector<Graph::Edge<double>>& items);
+        void AddBusNames(const vector<RouteItem>& items, Svg::Document& svg) const;
 
-        void AddStops(const vector<Graph::Edge<double>>& items);
+        void AddStops(const vector<RouteItem>& items, Svg::Document& svg) const;
 
-        void AddNames(const vector<Graph::Edge<double>>& items);
+        void AddNames(const vector<RouteItem>& items, Svg::Document& svg) const;
 
+        // Safe to call concurrently: the route is drawn into its own overlay.
+        string RenderRoute(const vector<RouteItem>& items) const;
 
-        string RenderRoute(const vector<Graph::Edge<double>>& items);
+        // Only the objects RenderRoute draws over the map, escaped as in the
+        // map string, so that they can be kept without a copy of the map.
+        string RenderRouteOverlay(const vector<RouteItem>& items) const;
+
+        // The map string with an overlay from RenderRouteOverlay on top.
+        string ComposeMap(string_view overlay) const;
+
+        // The routes on one map, layer by layer, with the first one on top.
+        string RenderRoutes(const vector<vector<RouteItem>>& routes) const;
+
+        // The map with the stops drawn over it, coloured from green for no
+        // travel time to red for max_time.
+        string RenderReachableStops(const vector<ReachableStop>& stops, double max_time) const;
     private:
         shared_ptr<Map> map;
-        Svg::Document base_svg;
-        size_t base_size = 0;
+        // Header and objects of the map with its underlayer, rendered once
+        // as the start of a quoted string; the footer ends that string.
+        string quoted_prefix;
+        string quoted_footer;
+
+        void AddLayer(LayerType layer, const vector<RouteItem>& items, Svg::Document& svg) const;
+        string RenderOverlay(const Svg::Document& overlay) const;
+        static string EscapeObjects(const Svg::Document& overlay);
+        void SetQuotedFooter();
     };
 }
 
 double ComputeDistance(const Coordinate& lhs, const Coordinate& rhs);
 
+// Stops, buses, names, the distance table, the router and the map are
+// immutable once built and are shared between copies, so a copy does not
+// duplicate them. The per-stop and per-bus tables are copied, which makes a
+// copy O(stops + buses + their routes). A copy changes the distance table or
+// rebuilds the rest without affecting the manager it was copied from.
 class TransportManager {
 public:
-    TransportManager(size_t bus_wait_time, size_t bus_velocity) :
+    TransportManager() = default;
+
+    TransportManager(size_t bus_wait_time, size_t bus_velocity, Graph::RouterType router_type = Graph::RouterType::ALL_PAIRS) :
         bus_wait_time_(bus_wait_time),
-        bus_velocity_(bus_velocity)
+        bus_velocity_(bus_velocity),
+        router_type_(router_type)
     {}
 
-    void AddStop(string stop_name, Coordinate coordinate);
+    static constexpr size_t DEFAULT_ROUTE_CACHE_CAPACITY = 64 << 20;
+
+    // Bounds the cache of built routes; zero turns it off. Drops the routes
+    // cached so far.
+    void SetRouteCacheCapacity(size_t capacity_bytes) {
+        route_cache_capacity_ = capacity_bytes;
+        ResetRouteCache();
+    }
+
+    // Zeros while there is no cache.
+    RouteCache::Stats GetRouteCacheStats() const {
+        return route_cache_ ? route_cache_->GetStats() : RouteCache::Stats();
+    }
+
+    // Takes effect on the next BuildRouter.
+    void SetRoutingSettings(size_t bus_wait_time, size_t bus_velocity, Graph::RouterType router_type) {
+        bus_wait_time_ = bus_wait_time;
+        bus_velocity_ = bus_velocity;
+        router_type_ = router_type;
+    }
+
+    void AddStop(string_view stop_name, Coordinate coordinate);
+
+    void AddBus(string_view bus_name, const vector<string>& stops, bool is_reversed);
+
+    void AddDistance(string_view from, string_view to, int distance);
+
+    // Real stop times of a bus added before, in minutes: one row per trip and
+    // one column per stop of Bus::GetRouteStop. GetRoute with a departure time
+    // uses them once BuildRouter has run; redefining the bus drops them.
+    // Throws invalid_argument for rows that do not fit the route.
+    void SetBusTimetable(string_view bus_name, vector<vector<double>> trips);
+
+    // Name lookups for the API boundary; nullptr for unknown names.
+    const Stop* FindStop(string_view stop_name) const;
+
+    const Bus* FindBus(string_view bus_name) const;
+
+    // Stops are indexed by StopId and hold nullptr for names that were
+    // mentioned by a bus or a distance but never added.
+    const vector<shared_ptr<const Stop>>& GetStops() const { return stops_; }
+
+    // Added stops in the order of their first AddStop.
+    const vector<StopId>& GetDeclaredStops() const { return declared_stops_; }
+
+    const vector<shared_ptr<const Bus>>& GetBuses() const { return buses_; }
+
+    const Stop* GetStop(StopId stop) const { return stops_[stop].get(); }
+
+    const Bus* GetBus(BusId bus) const { return buses_[bus].get(); }
+
+    // Also names stops that were mentioned but never added.
+    string_view GetStopName(StopId stop) const { return stop_names_.GetName(stop); }
+
+    // nullopt when no distance is known in either direction.
+    optional<int> GetRoadDistance(StopId from, StopId to) const {
+        return distances_->Get(from, to);
+    }
 
-    void AddBus(string bus_name, vector<string> stops, bool is_reversed);
+    // Served from the route cache once the router and the map are built.
+    pair<string, vector<RouteItem>> GetRoute(string_view from, string_view to) const;
 
-    void AddDistance(const string& from, const string& to, int distance);
+    // Earliest arrival over the timetables for a departure from from at
+    // departure_time or later. Waits are the gaps before every boarding, so
+    // the route takes the arrival minus departure_time. Not cached. Without
+    // any timetable, the route that GetRoute finds over the graph.
+    pair<string, vector<RouteItem>> GetRoute(string_view from, string_view to, double departure_time) const;
 
-    const Bus* GetBus(const string& bus_name) const;
+    // GetRoute for every stop of to. The routes missing from the cache come
+    // from one search out of from.
+    vector<pair<string, vector<RouteItem>>> GetRoutes(string_view from, const vector<string_view>& to) const;
 
-    pair<string, vector<Graph::Edge<double>>> GetRoute(const string& from, const string& to) const;
+    // Travel times, and optionally items, from every stop of from to every
+    // stop of to, with one search per origin and nothing rendered.
+    RouteMatrix GetRouteMatrix(const vector<string_view>& from, const vector<string_view>& to, bool with_items) const;
 
-    const unordered_map<string, unique_ptr<Bus>>& GetBuses() const;
+    // Up to count different routes, fastest first, drawn together on one map
+    // with the fastest on top. A route that gets off a bus only to board it
+    // again where it could have stayed on does not count. Nothing is cached.
+    pair<string, vector<vector<RouteItem>>> GetAlternativeRoutes(string_view from, string_view to, size_t count) const;
 
-    const unordered_map<string, unique_ptr<Stop>>& GetStops() const;
+    // Routes that trade travel time for transfers: the fastest one first,
+    // then every slower one with fewer transfers than all before it. Empty
+    // when to cannot be reached. Nothing is rendered or cached.
+    vector<ParetoRoute> GetParetoRoutes(string_view from, string_view to) const;
 
-    const Stop* GetStop(const string& stop_name) const;
+    // Stops within max_time minutes of from, the wait for the first bus
+    // included, nearest first and by name among equals; from comes first.
+    // The search ends at the first stop beyond max_time.
+    vector<ReachableStop> GetReachableStops(string_view from, double max_time) const;
 
+    string RenderReachableStops(const vector<ReachableStop>& stops, double max_time) const {
+        return reoute_renderer->RenderReachableStops(stops, max_time);
+    }
+
+    // Buses through the stop, sorted by name and without repeats. Served from
+    // the table built by Finalize while the network is unchanged, computed on
+    // the spot otherwise.
+    vector<BusId> GetStopBuses(StopId stop) const;
+
+    // Served from the table built by Finalize while the network is unchanged,
+    // computed on the spot otherwise.
+    BusStats GetBusStats(BusId bus) const;
+
+    // Resolves the distances and builds the per-stop and per-bus indexes;
+    // call after the last Add*. Any later Add* call drops both indexes.
+    NetworkValidation Finalize();
+
+    // Builds the router for the current network. When a router exists and
+    // the network has only grown since it was built (new stops, new buses,
+    // distances that no routed bus uses) and the settings are unchanged, the
+    // all-pairs router is extended with the new edges instead. That copies
+    // the V^2 tables and relaxes them through every endpoint of a new edge:
+    // O(V^2 + endpoints * V^2) rather than the O(V^3) of a rebuild, so it
+    // still grows with the network. Anything else, and the other router
+    // types, lead to a full rebuild.
     void BuildRouter();
 
-    void BuildMap(std::map<std::string, Json::Node> properties) {
+    // Writes the finalized network with its router and map to path, replacing
+    // the file atomically. Requires BuildRouter and BuildMap.
+    void SaveSnapshot(const string& path) const;
+
+    // Replaces everything with a snapshot written by SaveSnapshot; the result
+    // answers queries as the saved manager did. Throws runtime_error on an
+    // incompatible or inconsistent file. The payload checksum reads the whole
+    // file up front, so it is only checked with verify_checksum.
+    void LoadSnapshot(const string& path, bool verify_checksum = false);
+
+    void BuildMap(const Json::View::Object& properties) {
         map_ = make_shared<Map::Map>(properties, *this);
-        map_.get()->RenderMap();
-        reoute_renderer = make_unique<Map::RouteRenderer>(map_);
+        reoute_renderer = make_shared<Map::RouteRenderer>(map_);
+        ResetRouteCache();
     }
 
     string GetMap() const {
         return string(map_.get()->GetMap());
     }
 
-    void ReleaseRoute(uint64_t id) {
-        router->ReleaseRoute(id);
+    // Only for routes built through the id-based router API; GetRoute keeps
+    // nothing in the router.
+    void ReleaseRoute(uint64_t id) const {
+        routing_->router->ReleaseRoute(id);
     }
 
     const Coordinate& GetMinCoodinate() const {
@@ -218,47 +586,160 @@ private:
     Coordinate min_coordinate;
 
     size_t stops_coutner = 0;
-    unordered_map<string, unique_ptr<Stop>> stops_;
-    unordered_map<string, unique_ptr<Bus>> buses_;
+    NameInterner stop_names_;
+    NameInterner bus_names_;
+    vector<shared_ptr<const Stop>> stops_;
+    vector<StopId> declared_stops_;
+    vector<shared_ptr<const Bus>> buses_;
+    // Copied before a change while another manager shares it.
+    shared_ptr<DistanceTable> distances_ = make_shared<DistanceTable>();
+    vector<vector<BusId>> stop_buses_;
+    vector<BusStats> bus_stats_;
 
     size_t bus_wait_time_ = 0;
     size_t bus_velocity_ = 0;
+    Graph::RouterType router_type_ = Graph::RouterType::ALL_PAIRS;
+
+    // WAIT and BUS edges form the span model, where a bus edge joins every pair
+    // of stops of a route. The ride model gives every (bus, route position) its
+    // own vertex instead, linked by RIDE edges and entered and left through
+    // zero-weight BOARD and ALIGHT edges, so edges grow linearly with routes.
+    enum class RouteEdgeType : uint8_t {
+        WAIT,
+        BUS,
+        BOARD,
+        RIDE,
+        ALIGHT,
+    };
+
+    // Description of every routing graph edge, stored column-wise by EdgeId.
+    struct RouteEdgesInfo {
+        vector<RouteEdgeType> types;
+        vector<uint32_t> owners;
+        vector<uint32_t> span_starts;
+        vector<uint32_t> span_counts;
+
+        void Add(RouteEdgeType type, size_t owner, size_t span_start, size_t span_count) {
+            types.push_back(type);
+            owners.push_back(owner);
+            span_starts.push_back(span_start);
+            span_counts.push_back(span_count);
+        }
+    };
 
-    unique_ptr<Graph::DirectedWeightedGraph<double>> graph_;
-    unique_ptr<Graph::Router<double>> router;
+    // What the current router was built from, for BuildRouter to decide whether
+    // it can be extended. Dropped when a routed bus is redefined.
+    struct RouterOrigin {
+        size_t bus_wait_time = 0;
+        size_t bus_velocity = 0;
+        Graph::RouterType router_type = Graph::RouterType::ALL_PAIRS;
+        size_t bus_count = 0;
+        // Stops that have a WAIT edge, by StopId.
+        vector<bool> waiting_stops;
+    };
+
+    optional<RouterOrigin> router_origin_;
+
+    // Everything BuildRouter produces, replaced as a whole and never changed.
+    struct Routing {
+        // Road distance from the first stop to every position of Bus::GetRouteStop, by BusId.
+        vector<vector<int>> bus_distances;
+        // Edge owners are StopIds for WAIT edges and BusIds for the others.
+        RouteEdgesInfo edges_info;
+        // The router refers to the graph, so they are replaced together.
+        shared_ptr<const Graph::CompactGraph<double>> graph;
+        shared_ptr<Graph::RouterBase<double>> router;
+        // Counts a boarding on every WAIT edge of graph.
+        shared_ptr<const Graph::ParetoRouter<double>> pareto_router;
+        shared_ptr<const Graph::YenRouter<double>> alternative_router;
+    };
 
-    unique_ptr<Map::RouteRenderer> reoute_renderer;
+    shared_ptr<const Routing> routing_;
+
+    // By BusId, nullptr for buses without a timetable.
+    vector<shared_ptr<const vector<vector<double>>>> bus_timetables_;
+    // Built by BuildRouter from bus_timetables_, nullptr when there are none.
+    shared_ptr<const Raptor::TimetableRouter> timetable_router_;
+
+    StopId InternStop(string_view stop_name);
+    void BuildStopBuses();
+    vector<BusId> ComputeStopBuses(StopId stop) const;
+    void SortBusesByName(vector<BusId>& buses) const;
+    void BuildBusStats();
+    NetworkValidation Validate() const;
+    BusStats ComputeBusStats(const Bus& bus) const;
+    DistanceTable& GetMutableDistances();
+    double GetRideTime(const vector<int>& bus_distances, size_t span_start, size_t span_count) const;
+    RouteItem MakeBusItem(BusId bus, size_t span_start, size_t span_count) const;
+
+    template <typename ChainCallback>
+    static void ForEachChain(const Bus& bus, ChainCallback callback);
+
+    vector<vector<int>> ComputeBusDistances() const;
+    bool CanExtendRouter(const vector<vector<int>>& bus_distances) const;
+    void ExtendRouter(vector<vector<int>> bus_distances);
+    void BuildTimetableRouter();
+    static void BuildAlternativeRouters(Routing& routing);
+    // Throws runtime_error when a loaded routing state refers to stops,
+    // buses or route positions the loaded network does not have.
+    void CheckRouting(const Routing& routing) const;
+
+    void AddWaitEdges(Graph::DirectedWeightedGraph<double>& graph, RouteEdgesInfo& edges_info, vector<bool>& waiting_stops) const;
+    void AddSpanEdges(Graph::DirectedWeightedGraph<double>& graph, RouteEdgesInfo& edges_info,
+                      const vector<vector<int>>& bus_distances, BusId first_bus = 0) const;
+    void AddRideEdges(Graph::DirectedWeightedGraph<double>& graph, RouteEdgesInfo& edges_info,
+                      const vector<vector<int>>& bus_distances) const;
+
+    shared_ptr<const Map::RouteRenderer> reoute_renderer;
     shared_ptr<Map::Map> map_;
+
+    // Bounds the routes GetAlternativeRoutes looks through per route it returns.
+    static constexpr size_t ROUTES_SEARCHED_PER_ALTERNATIVE = 8;
+
+    // Cached routes refer to stops and buses of this version, so AddStop and
+    // AddBus drop the cache, and a new one starts with every router or map.
+    size_t route_cache_capacity_ = DEFAULT_ROUTE_CACHE_CAPACITY;
+    shared_ptr<const RouteCache> route_cache_;
+
+    void ResetRouteCache();
+    RouteCache::Value BuildRoute(const Stop& from, const Stop& to) const;
+    // The route with the map under its overlay, as GetRoute returns it.
+    pair<string, vector<RouteItem>> ComposeRoute(const RouteCache::Value& route) const;
+    // Turns routing graph edges into items, merging a BOARD ... ALIGHT run into one ride.
+    vector<RouteItem> MakeRouteItems(const vector<Graph::EdgeId>& edges) const;
 };
 
 class Stop {
 public:
-    Stop(const string& name, Coordinate coordinate, size_t indx) : name_(name), coordinate_(coordinate), indx_(indx) {}
+    Stop(StopId id, string_view name, Coordinate coordinate, size_t indx) : id_(id), name_(name), coordinate_(coordinate), indx_(indx) {}
 
-    string_view GetName() { return string_view(name_); }
+    StopId GetId() const { return id_; }
 
-    void AddDistance(const string& to, int distance) { distances_[to] = distance; }
-
-    int GetDistance(const string& to) const {
-        return distances_.at(to);
-    }
+    string_view GetName() const { return name_; }
 
     const Coordinate& GetCoordinate() const { return coordinate_; }
 
+    // Routing graph vertices: the stop itself and the boarding side of it.
+    // They follow the order of declaration, so ties between equally fast
+    // routes resolve as they did before interning.
     pair<size_t, size_t> GetIndx() const {
-        return { indx_, indx_ + 1 };
+        return { 2 * indx_, 2 * indx_ + 1 };
     }
 
 private:
-    size_t indx_;
-    string name_;
+    StopId id_;
+    string_view name_;
     Coordinate coordinate_;
-    unordered_map<string, int> distances_;
+    size_t indx_;
 };
 
 class Bus {
 public:
-    Bus(const string& name, vector<string> stops, bool is_reversed) : name_(name), stops_(stops), is_reversed_(is_reversed) {}
+    Bus(BusId id, string_view name, vector<StopId> stops, bool is_reversed) : id_(id), name_(name), stops_(move(stops)), is_reversed_(is_reversed) {}
+
+    BusId GetId() const { return id_; }
+
+    string_view GetName() const { return name_; }
 
     size_t GetStopsNum() const {
         if (is_reversed_) return stops_.size() * 2 - 1;
@@ -266,11 +747,12 @@ public:
     }
 
     size_t GetUniqueStopsNum() const {
-        set<string> unique_stops(stops_.begin(), stops_.end());
-        return unique_stops.size();
+        vector<StopId> unique_stops = stops_;
+        sort(unique_stops.begin(), unique_stops.end());
+        return unique(unique_stops.begin(), unique_stops.end()) - unique_stops.begin();
     }
 
-    bool IsEnding(string_view stop) const;
+    bool IsEnding(StopId stop) const;
 
     int GetLength(const TransportManager& manager) const;
 
@@ -283,18 +765,60 @@ public:
         return length;
     }
 
-    bool Find(string_view stop_name) const {
-        return (find(stops_.begin(), stops_.end(), stop_name) != stops_.end());
+    bool Find(StopId stop) const {
+        return (find(stops_.begin(), stops_.end(), stop) != stops_.end());
     }
 
-    const auto& GetStops() const {
+    const vector<StopId>& GetStops() const {
         return stops_;
     }
 
+    // Stops in riding order: a non-roundtrip bus runs back after the last stop.
+    StopId GetRouteStop(size_t position) const {
+        if (position < stops_.size()) return stops_[position];
+        return stops_[2 * (stops_.size() - 1) - position];
+    }
+
     bool IsReversed() const { return is_reversed_; }
 
 private:
-    string name_;
-    vector<string> stops_;
+    BusId id_;
+    string_view name_;
+    vector<StopId> stops_;
     bool is_reversed_;
-};
\ No newline at end of file
+};
+
+// Publishes immutable versions of a TransportManager. Readers take the
+// current version and may query it for as long as they hold it; a version is
+// freed when its last reader drops it. Taking and publishing a version go
+// through atomic_load and atomic_store on a shared_ptr, which libstdc++
+// implements with a small global pool of spinlocks: a reader never waits for
+// an update to be built, but it briefly contends with other readers and with
+// the store that publishes it. An update copies the current version (see the
+// cost above), changes the copy and publishes it, so it is meant for
+// occasional network changes, not per-request writes. Writers are serialized.
+class TransportManagerVersions {
+public:
+    explicit TransportManagerVersions(TransportManager manager)
+        : current_(make_shared<const TransportManager>(move(manager))) {}
+
+    shared_ptr<const TransportManager> Acquire() const {
+        return atomic_load(&current_);
+    }
+
+    // Calls update on a copy of the current version, then publishes the copy.
+    // If update throws, nothing is published. Returns the published version.
+    template <typename UpdateFunction>
+    shared_ptr<const TransportManager> Update(UpdateFunction update) {
+        lock_guard lock(writer_mutex_);
+        auto next = make_shared<TransportManager>(*atomic_load(&current_));
+        update(*next);
+        shared_ptr<const TransportManager> published = move(next);
+        atomic_store(&current_, published);
+        return published;
+    }
+
+private:
+    shared_ptr<const TransportManager> current_;
+    mutex writer_mutex_;
+};
@@ -0,0 +1,459 @@
+#pragma once
+
+#include "dijkstra_router.h"
+#include "graph.h"
+#include "router.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace Graph {
+
+    // Contraction Hierarchies: vertices are contracted one by one in the order of
+    // their edge difference, and shortcuts are added wherever a local witness
+    // search cannot prove that a shorter detour exists. A query is a bidirectional
+    // Dijkstra that only climbs the hierarchy, and every shortcut on the found
+    // path is unpacked back into the edges of the original graph. Search labels
+    // live in pooled workspaces, so queries may run concurrently. The hierarchy
+    // is kept in flat arrays, which a router restored from a snapshot reads in
+    // place. Routes weigh the same as those of the all-pairs Router, but where
+    // several routes tie, the two may return different ones.
+    template <typename Weight>
+    class ContractionHierarchiesRouter : public RouterBase<Weight> {
+    private:
+        using Graph = CompactGraph<Weight>;
+
+    public:
+        using typename RouterBase<Weight>::Route;
+
+        ContractionHierarchiesRouter(const Graph& graph);
+        ContractionHierarchiesRouter(const Graph& graph, Snapshot::Reader& reader);
+
+        std::optional<Weight> FindRouteEdges(VertexId from, VertexId to, std::vector<EdgeId>& edges) const override;
+        // A plain search of the original graph from the source settles many
+        // targets at once, which beats one hierarchy query per target; the
+        // same search bounded by weight finds the reachable vertices.
+        std::vector<std::optional<Route>> FindRoutes(VertexId from, const std::vector<VertexId>& targets,
+                                                     bool with_edges) const override {
+            return tree_router_.FindRoutes(from, targets, with_edges);
+        }
+        std::vector<std::pair<VertexId, Weight>> FindReachable(VertexId from, Weight max_weight) const override {
+            return tree_router_.FindReachable(from, max_weight);
+        }
+        void Save(Snapshot::Writer& writer) const override;
+
+    private:
+        static constexpr size_t WITNESS_SETTLED_LIMIT = 500;
+
+        // Ids below the graph edge count refer to original edges,
+        // the rest are shortcuts indexed from edge count.
+        struct Arc {
+            VertexId to;
+            Weight weight;
+            EdgeId id;
+        };
+
+        struct Shortcut {
+            EdgeId first;
+            EdgeId second;
+        };
+
+        struct SearchGraph {
+            Snapshot::SharedArray<uint64_t> offsets;
+            Snapshot::SharedArray<Arc> arcs;
+
+            Range<const Arc*> GetArcs(VertexId vertex) const {
+                return {arcs.begin() + offsets[vertex], arcs.begin() + offsets[vertex + 1]};
+            }
+        };
+
+        struct VertexData {
+            Weight weight;
+            std::optional<EdgeId> prev_arc;
+            VertexId prev_vertex;
+            uint32_t stamp = 0;
+        };
+
+        struct Workspace {
+            std::vector<VertexData> forward_data;
+            std::vector<VertexData> backward_data;
+            // Path unpacking scratch, kept to avoid allocating per query.
+            std::vector<EdgeId> forward_arcs;
+            std::vector<EdgeId> unpack_stack;
+            uint32_t current_stamp = 0;
+
+            explicit Workspace(size_t vertex_count) : forward_data(vertex_count), backward_data(vertex_count) {}
+
+            void Reset() {
+                if (++current_stamp == 0) {
+                    for (auto& vertex_data : forward_data) {
+                        vertex_data.stamp = 0;
+                    }
+                    for (auto& vertex_data : backward_data) {
+                        vertex_data.stamp = 0;
+                    }
+                    current_stamp = 1;
+                }
+            }
+        };
+
+        using QueueItem = std::pair<Weight, VertexId>;
+        using Queue = std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>>;
+
+        const Graph& graph_;
+        Snapshot::SharedArray<Shortcut> shortcuts_;
+        SearchGraph forward_up_;
+        SearchGraph backward_up_;
+
+        WorkspacePool<Workspace> workspaces_;
+        DijkstraRouter<Weight> tree_router_;
+
+        class Contractor;
+
+        void UnpackArc(EdgeId arc_id, std::vector<EdgeId>& stack, std::vector<EdgeId>& edges) const;
+        bool Settle(const SearchGraph& search_graph, Queue& queue, std::vector<VertexData>& data, uint32_t current_stamp) const;
+    };
+
+    // Preprocessing state, dropped once the search graphs are built.
+    template <typename Weight>
+    class ContractionHierarchiesRouter<Weight>::Contractor {
+    public:
+        Contractor(const Graph& graph, std::vector<Shortcut>& shortcuts)
+            : edge_count_(graph.GetEdgeCount()),
+            shortcuts_(shortcuts),
+            out_(graph.GetVertexCount()),
+            in_(graph.GetVertexCount()),
+            contracted_(graph.GetVertexCount(), false),
+            deleted_neighbours_(graph.GetVertexCount(), 0),
+            rank_(graph.GetVertexCount(), 0),
+            witness_data_(graph.GetVertexCount())
+        {
+            for (EdgeId edge_id = 0; edge_id < edge_count_; ++edge_id) {
+                const auto edge = graph.GetEdge(edge_id);
+                assert(edge.weight >= 0);
+                if (edge.from != edge.to) {
+                    AddArc(edge.from, edge.to, edge.weight, edge_id);
+                }
+            }
+        }
+
+        void Contract() {
+            const size_t vertex_count = out_.size();
+            Queue queue;
+            for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+                queue.push({ComputePriority(vertex), vertex});
+            }
+            size_t next_rank = 0;
+            while (!queue.empty()) {
+                const VertexId vertex = queue.top().second;
+                queue.pop();
+                const Weight priority = ComputePriority(vertex);
+                if (!queue.empty() && priority > queue.top().first) {
+                    queue.push({priority, vertex});
+                    continue;
+                }
+                ContractVertex(vertex, true);
+                rank_[vertex] = next_rank++;
+            }
+        }
+
+        void BuildSearchGraphs(SearchGraph& forward_up, SearchGraph& backward_up) const {
+            forward_up = BuildSearchGraph(out_);
+            backward_up = BuildSearchGraph(in_);
+        }
+
+    private:
+        struct WitnessData {
+            Weight weight;
+            uint32_t stamp = 0;
+        };
+
+        const size_t edge_count_;
+        std::vector<Shortcut>& shortcuts_;
+        // in_ stores reversed arcs: Arc::to is the tail of the original arc.
+        std::vector<std::vector<Arc>> out_;
+        std::vector<std::vector<Arc>> in_;
+        std::vector<bool> contracted_;
+        std::vector<size_t> deleted_neighbours_;
+        std::vector<size_t> rank_;
+        std::vector<WitnessData> witness_data_;
+        uint32_t witness_stamp_ = 0;
+
+        void AddArc(VertexId from, VertexId to, Weight weight, EdgeId id) {
+            for (Arc& arc : out_[from]) {
+                if (arc.to == to) {
+                    if (weight < arc.weight) {
+                        arc.weight = weight;
+                        arc.id = id;
+                        for (Arc& reversed_arc : in_[to]) {
+                            if (reversed_arc.to == from) {
+                                reversed_arc.weight = weight;
+                                reversed_arc.id = id;
+                            }
+                        }
+                    }
+                    return;
+                }
+            }
+            out_[from].push_back({to, weight, id});
+            in_[to].push_back({from, weight, id});
+        }
+
+        // Returns whether a path from source to target avoiding the contracted
+        // vertices and via_vertex is at most max_weight long.
+        bool HasWitness(VertexId source, VertexId target, VertexId via_vertex, Weight max_weight) {
+            if (++witness_stamp_ == 0) {
+                for (auto& data : witness_data_) {
+                    data.stamp = 0;
+                }
+                witness_stamp_ = 1;
+            }
+            Queue queue;
+            witness_data_[source] = {0, witness_stamp_};
+            queue.push({0, source});
+            size_t settled_count = 0;
+            while (!queue.empty() && settled_count < WITNESS_SETTLED_LIMIT) {
+                const auto [weight, vertex] = queue.top();
+                queue.pop();
+                if (weight > max_weight) {
+                    return false;
+                }
+                if (witness_data_[vertex].weight < weight) {
+                    continue;
+                }
+                if (vertex == target) {
+                    return true;
+                }
+                ++settled_count;
+                for (const Arc& arc : out_[vertex]) {
+                    if (contracted_[arc.to] || arc.to == via_vertex) {
+                        continue;
+                    }
+                    auto& data = witness_data_[arc.to];
+                    const Weight candidate_weight = weight + arc.weight;
+                    if (data.stamp != witness_stamp_ || candidate_weight < data.weight) {
+                        data = {candidate_weight, witness_stamp_};
+                        queue.push({candidate_weight, arc.to});
+                    }
+                }
+            }
+            return false;
+        }
+
+        // Adds the shortcuts needed to bypass vertex, or only counts them when
+        // apply is false. Returns the number of shortcuts.
+        size_t ContractVertex(VertexId vertex, bool apply) {
+            size_t shortcut_count = 0;
+            const std::vector<Arc>& incoming = in_[vertex];
+            const std::vector<Arc>& outgoing = out_[vertex];
+            for (const Arc& in_arc : incoming) {
+                if (contracted_[in_arc.to]) {
+                    continue;
+                }
+                for (const Arc& out_arc : outgoing) {
+                    if (contracted_[out_arc.to] || out_arc.to == in_arc.to) {
+                        continue;
+                    }
+                    const Weight weight = in_arc.weight + out_arc.weight;
+                    if (HasWitness(in_arc.to, out_arc.to, vertex, weight)) {
+                        continue;
+                    }
+                    ++shortcut_count;
+                    if (apply) {
+                        shortcuts_.push_back({in_arc.id, out_arc.id});
+                        AddArc(in_arc.to, out_arc.to, weight, edge_count_ + shortcuts_.size() - 1);
+                    }
+                }
+            }
+            if (apply) {
+                contracted_[vertex] = true;
+                for (const Arc& arc : incoming) {
+                    ++deleted_neighbours_[arc.to];
+                }
+                for (const Arc& arc : outgoing) {
+                    ++deleted_neighbours_[arc.to];
+                }
+            }
+            return shortcut_count;
+        }
+
+        // Keeps the arcs leading up the hierarchy.
+        SearchGraph BuildSearchGraph(const std::vector<std::vector<Arc>>& arcs) const {
+            const size_t vertex_count = arcs.size();
+            std::vector<uint64_t> offsets(vertex_count + 1, 0);
+            std::vector<Arc> up_arcs;
+            for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+                offsets[vertex + 1] = offsets[vertex];
+                for (const Arc& arc : arcs[vertex]) {
+                    if (rank_[arc.to] > rank_[vertex]) {
+                        up_arcs.push_back(arc);
+                        ++offsets[vertex + 1];
+                    }
+                }
+            }
+            return {Snapshot::SharedArray<uint64_t>(std::move(offsets)), Snapshot::SharedArray<Arc>(std::move(up_arcs))};
+        }
+
+        Weight ComputePriority(VertexId vertex) {
+            size_t removed_count = 0;
+            for (const Arc& arc : in_[vertex]) {
+                removed_count += !contracted_[arc.to];
+            }
+            for (const Arc& arc : out_[vertex]) {
+                removed_count += !contracted_[arc.to];
+            }
+            const size_t shortcut_count = ContractVertex(vertex, false);
+            return static_cast<Weight>(shortcut_count) - static_cast<Weight>(removed_count)
+                + static_cast<Weight>(deleted_neighbours_[vertex]);
+        }
+    };
+
+
+    template <typename Weight>
+    ContractionHierarchiesRouter<Weight>::ContractionHierarchiesRouter(const Graph& graph)
+        : graph_(graph),
+        workspaces_(graph.GetVertexCount()),
+        tree_router_(graph)
+    {
+        std::vector<Shortcut> shortcuts;
+        Contractor contractor(graph, shortcuts);
+        contractor.Contract();
+        contractor.BuildSearchGraphs(forward_up_, backward_up_);
+        shortcuts_ = Snapshot::SharedArray<Shortcut>(std::move(shortcuts));
+    }
+
+    template <typename Weight>
+    ContractionHierarchiesRouter<Weight>::ContractionHierarchiesRouter(const Graph& graph, Snapshot::Reader& reader)
+        : graph_(graph),
+        shortcuts_(reader.ReadShared<Shortcut>()),
+        workspaces_(graph.GetVertexCount()),
+        tree_router_(graph)
+    {
+        for (SearchGraph* search_graph : {&forward_up_, &backward_up_}) {
+            search_graph->offsets = reader.ReadShared<uint64_t>();
+            search_graph->arcs = reader.ReadShared<Arc>();
+            if (search_graph->offsets.size() != graph.GetVertexCount() + 1
+                    || search_graph->offsets.back() != search_graph->arcs.size()) {
+                throw std::runtime_error("snapshot: hierarchy does not match the graph");
+            }
+        }
+    }
+
+    template <typename Weight>
+    void ContractionHierarchiesRouter<Weight>::Save(Snapshot::Writer& writer) const {
+        writer.WriteVector(shortcuts_);
+        for (const SearchGraph* search_graph : {&forward_up_, &backward_up_}) {
+            writer.WriteVector(search_graph->offsets);
+            writer.WriteVector(search_graph->arcs);
+        }
+    }
+
+    template <typename Weight>
+    bool ContractionHierarchiesRouter<Weight>::Settle(const SearchGraph& search_graph, Queue& queue, std::vector<VertexData>& data, uint32_t current_stamp) const {
+        const auto [weight, vertex] = queue.top();
+        queue.pop();
+        if (data[vertex].weight < weight) {
+            return false;
+        }
+        for (const Arc& arc : search_graph.GetArcs(vertex)) {
+            auto& vertex_data = data[arc.to];
+            const Weight candidate_weight = weight + arc.weight;
+            if (vertex_data.stamp != current_stamp || candidate_weight < vertex_data.weight) {
+                vertex_data = {candidate_weight, arc.id, vertex, current_stamp};
+                queue.push({candidate_weight, arc.to});
+            }
+        }
+        return true;
+    }
+
+    template <typename Weight>
+    std::optional<Weight> ContractionHierarchiesRouter<Weight>::FindRouteEdges(VertexId from, VertexId to, std::vector<EdgeId>& edges) const {
+        const auto workspace = workspaces_.Acquire();
+        workspace->Reset();
+        auto& forward_data = workspace->forward_data;
+        auto& backward_data = workspace->backward_data;
+        const uint32_t current_stamp = workspace->current_stamp;
+        Queue forward_queue;
+        Queue backward_queue;
+        forward_data[from] = {0, std::nullopt, from, current_stamp};
+        backward_data[to] = {0, std::nullopt, to, current_stamp};
+        forward_queue.push({0, from});
+        backward_queue.push({0, to});
+
+        std::optional<Weight> best_weight;
+        VertexId meeting_vertex = from;
+        const auto update_best = [&](VertexId vertex) {
+            if (forward_data[vertex].stamp != current_stamp || backward_data[vertex].stamp != current_stamp) {
+                return;
+            }
+            const Weight weight = forward_data[vertex].weight + backward_data[vertex].weight;
+            if (!best_weight || weight < *best_weight) {
+                best_weight = weight;
+                meeting_vertex = vertex;
+            }
+        };
+
+        while (!forward_queue.empty() || !backward_queue.empty()) {
+            if (!forward_queue.empty() && best_weight && forward_queue.top().first >= *best_weight) {
+                forward_queue = Queue();
+            }
+            if (!backward_queue.empty() && best_weight && backward_queue.top().first >= *best_weight) {
+                backward_queue = Queue();
+            }
+            if (!forward_queue.empty()) {
+                const VertexId vertex = forward_queue.top().second;
+                if (Settle(forward_up_, forward_queue, forward_data, current_stamp)) {
+                    update_best(vertex);
+                }
+            }
+            if (!backward_queue.empty()) {
+                const VertexId vertex = backward_queue.top().second;
+                if (Settle(backward_up_, backward_queue, backward_data, current_stamp)) {
+                    update_best(vertex);
+                }
+            }
+        }
+
+        if (!best_weight) {
+            return std::nullopt;
+        }
+        edges.clear();
+        auto& forward_arcs = workspace->forward_arcs;
+        forward_arcs.clear();
+        for (VertexId vertex = meeting_vertex; forward_data[vertex].prev_arc; vertex = forward_data[vertex].prev_vertex) {
+            forward_arcs.push_back(*forward_data[vertex].prev_arc);
+        }
+        for (auto it = forward_arcs.rbegin(); it != forward_arcs.rend(); ++it) {
+            UnpackArc(*it, workspace->unpack_stack, edges);
+        }
+        for (VertexId vertex = meeting_vertex; backward_data[vertex].prev_arc; vertex = backward_data[vertex].prev_vertex) {
+            UnpackArc(*backward_data[vertex].prev_arc, workspace->unpack_stack, edges);
+        }
+        return best_weight;
+    }
+
+    template <typename Weight>
+    void ContractionHierarchiesRouter<Weight>::UnpackArc(EdgeId arc_id, std::vector<EdgeId>& stack, std::vector<EdgeId>& edges) const {
+        stack.assign(1, arc_id);
+        while (!stack.empty()) {
+            const EdgeId id = stack.back();
+            stack.pop_back();
+            if (id < graph_.GetEdgeCount()) {
+                edges.push_back(id);
+            } else {
+                const Shortcut& shortcut = shortcuts_[id - graph_.GetEdgeCount()];
+                stack.push_back(shortcut.second);
+                stack.push_back(shortcut.first);
+            }
+        }
+    }
+
+}
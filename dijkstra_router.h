@@ -0,0 +1,205 @@
+#pragma once
+
+#include "graph.h"
+#include "router.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace Graph {
+
+    // Answers every query with a binary-heap Dijkstra, so nothing is precomputed
+    // and memory stays O(V + E). Distance labels are reset lazily through
+    // per-vertex stamps, which keeps a query proportional to the explored area.
+    // Labels live in pooled workspaces, so queries may run concurrently.
+    template <typename Weight>
+    class DijkstraRouter : public RouterBase<Weight> {
+    private:
+        using Graph = CompactGraph<Weight>;
+
+    public:
+        using typename RouterBase<Weight>::Route;
+
+        DijkstraRouter(const Graph& graph);
+
+        std::optional<Weight> FindRouteEdges(VertexId from, VertexId to, std::vector<EdgeId>& edges) const override;
+        // One search that stops once every target is settled.
+        std::vector<std::optional<Route>> FindRoutes(VertexId from, const std::vector<VertexId>& targets,
+                                                     bool with_edges) const override;
+        // Stops at the first vertex beyond max_weight, so only the reachable
+        // area is explored.
+        std::vector<std::pair<VertexId, Weight>> FindReachable(VertexId from, Weight max_weight) const override;
+        // Nothing is precomputed, so nothing is saved.
+        void Save(Snapshot::Writer&) const override {}
+
+    private:
+        const Graph& graph_;
+
+        struct VertexData {
+            Weight weight;
+            std::optional<EdgeId> prev_edge;
+            uint32_t stamp = 0;
+        };
+
+        struct Workspace {
+            std::vector<VertexData> vertices_data;
+            // Vertices still to settle in a one-to-many search carry the stamp.
+            std::vector<uint32_t> target_stamps;
+            uint32_t current_stamp = 0;
+
+            explicit Workspace(size_t vertex_count) : vertices_data(vertex_count) {}
+
+            void Reset() {
+                if (++current_stamp == 0) {
+                    for (auto& vertex_data : vertices_data) {
+                        vertex_data.stamp = 0;
+                    }
+                    std::fill(target_stamps.begin(), target_stamps.end(), 0);
+                    current_stamp = 1;
+                }
+            }
+        };
+
+        using QueueItem = std::pair<Weight, VertexId>;
+
+        WorkspacePool<Workspace> workspaces_;
+
+        // Settles vertices from the source in order of weight until is_done
+        // returns true for a settled vertex or nothing is left.
+        template <typename IsDone>
+        void Search(Workspace& workspace, VertexId from, IsDone is_done) const;
+        void CollectEdges(const Workspace& workspace, VertexId to, std::vector<EdgeId>& edges) const;
+    };
+
+
+    template <typename Weight>
+    DijkstraRouter<Weight>::DijkstraRouter(const Graph& graph)
+        : graph_(graph),
+        workspaces_(graph.GetVertexCount())
+    {
+    }
+
+    template <typename Weight>
+    template <typename IsDone>
+    void DijkstraRouter<Weight>::Search(Workspace& workspace, VertexId from, IsDone is_done) const {
+        auto& vertices_data = workspace.vertices_data;
+        const uint32_t current_stamp = workspace.current_stamp;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+        vertices_data[from] = {0, std::nullopt, current_stamp};
+        queue.push({0, from});
+
+        while (!queue.empty()) {
+            const auto [weight, vertex] = queue.top();
+            queue.pop();
+            if (vertices_data[vertex].weight < weight) {
+                continue;
+            }
+            if (is_done(vertex)) {
+                break;
+            }
+            for (const EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+                const VertexId edge_to = graph_.GetEdgeTo(edge_id);
+                const Weight edge_weight = graph_.GetEdgeWeight(edge_id);
+                assert(edge_weight >= 0);
+                auto& vertex_data = vertices_data[edge_to];
+                const Weight candidate_weight = weight + edge_weight;
+                if (vertex_data.stamp != current_stamp || candidate_weight < vertex_data.weight) {
+                    vertex_data = {candidate_weight, edge_id, current_stamp};
+                    queue.push({candidate_weight, edge_to});
+                }
+            }
+        }
+    }
+
+    template <typename Weight>
+    void DijkstraRouter<Weight>::CollectEdges(const Workspace& workspace, VertexId to, std::vector<EdgeId>& edges) const {
+        const auto& vertices_data = workspace.vertices_data;
+        edges.clear();
+        for (std::optional<EdgeId> edge_id = vertices_data[to].prev_edge;
+                edge_id;
+                edge_id = vertices_data[graph_.GetEdgeFrom(*edge_id)].prev_edge) {
+            edges.push_back(*edge_id);
+        }
+        std::reverse(std::begin(edges), std::end(edges));
+    }
+
+    template <typename Weight>
+    std::optional<Weight> DijkstraRouter<Weight>::FindRouteEdges(VertexId from, VertexId to, std::vector<EdgeId>& edges) const {
+        const auto workspace = workspaces_.Acquire();
+        workspace->Reset();
+        Search(*workspace, from, [to](VertexId vertex) { return vertex == to; });
+
+        const auto& target_data = workspace->vertices_data[to];
+        if (target_data.stamp != workspace->current_stamp) {
+            return std::nullopt;
+        }
+        CollectEdges(*workspace, to, edges);
+        return target_data.weight;
+    }
+
+    template <typename Weight>
+    std::vector<std::optional<typename DijkstraRouter<Weight>::Route>> DijkstraRouter<Weight>::FindRoutes(
+            VertexId from, const std::vector<VertexId>& targets, bool with_edges) const {
+        const auto workspace = workspaces_.Acquire();
+        workspace->Reset();
+        const uint32_t current_stamp = workspace->current_stamp;
+        auto& target_stamps = workspace->target_stamps;
+        target_stamps.resize(workspace->vertices_data.size(), 0);
+        size_t remaining = 0;
+        for (const VertexId to : targets) {
+            if (target_stamps[to] != current_stamp) {
+                target_stamps[to] = current_stamp;
+                ++remaining;
+            }
+        }
+        if (remaining > 0) {
+            Search(*workspace, from, [&](VertexId vertex) {
+                if (target_stamps[vertex] != current_stamp) {
+                    return false;
+                }
+                target_stamps[vertex] = 0;
+                return --remaining == 0;
+            });
+        }
+
+        std::vector<std::optional<Route>> routes;
+        routes.reserve(targets.size());
+        for (const VertexId to : targets) {
+            const auto& target_data = workspace->vertices_data[to];
+            if (target_data.stamp != current_stamp) {
+                routes.push_back(std::nullopt);
+                continue;
+            }
+            Route route{target_data.weight, {}};
+            if (with_edges) {
+                CollectEdges(*workspace, to, route.edges);
+            }
+            routes.push_back(std::move(route));
+        }
+        return routes;
+    }
+
+    template <typename Weight>
+    std::vector<std::pair<VertexId, Weight>> DijkstraRouter<Weight>::FindReachable(VertexId from, Weight max_weight) const {
+        const auto workspace = workspaces_.Acquire();
+        workspace->Reset();
+        std::vector<std::pair<VertexId, Weight>> reachable;
+        Search(*workspace, from, [&](VertexId vertex) {
+            const Weight weight = workspace->vertices_data[vertex].weight;
+            if (weight > max_weight) {
+                return true;
+            }
+            reachable.emplace_back(vertex, weight);
+            return false;
+        });
+        return reachable;
+    }
+
+}
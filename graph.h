@@ -1,9 +1,15 @@
 #pragma once
 
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <deque>
+#include <iterator>
 #include <vector>
 #include <string>
+#include <utility>
 
 template <typename It>
 class Range {
@@ -25,15 +31,11 @@ namespace Graph {
     using EdgeId = size_t;
 
     template <typename Weight>
-        struct Edge {
-            VertexId from;
-            VertexId to;
-            std::string type;
-            std::string text;
-            size_t stop_count = 0;
-            Weight weight;
-            std::vector<std::pair<std::string_view, std::string_view>> stops_list;
-        };
+    struct Edge {
+        VertexId from;
+        VertexId to;
+        Weight weight;
+    };
 
     template <typename Weight>
     class DirectedWeightedGraph {
@@ -88,4 +90,172 @@ namespace Graph {
         const auto& edges = incidence_lists_[vertex];
         return {std::begin(edges), std::end(edges)};
     }
+
+    class EdgeIdIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = EdgeId;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const EdgeId*;
+        using reference = EdgeId;
+
+        explicit EdgeIdIterator(EdgeId edge_id) : edge_id_(edge_id) {}
+
+        EdgeId operator*() const { return edge_id_; }
+        EdgeIdIterator& operator++() { ++edge_id_; return *this; }
+        bool operator==(const EdgeIdIterator& other) const { return edge_id_ == other.edge_id_; }
+        bool operator!=(const EdgeIdIterator& other) const { return edge_id_ != other.edge_id_; }
+
+    private:
+        EdgeId edge_id_;
+    };
+
+    // Frozen compressed-sparse-row copy of a DirectedWeightedGraph. Edges are
+    // renumbered in the order of their source vertex, so the incident edges of a
+    // vertex form a contiguous id range and a relaxation only reads the target
+    // and weight arrays. A graph restored from a snapshot reads the arrays in
+    // place from the mapped file.
+    template <typename Weight>
+    class CompactGraph {
+    private:
+        using IncidentEdgesRange = Range<EdgeIdIterator>;
+
+    public:
+        // edge_order, if given, receives the source graph edge id of every new edge id.
+        explicit CompactGraph(const DirectedWeightedGraph<Weight>& graph, std::vector<EdgeId>* edge_order = nullptr);
+        // Copy of base with the edges of added appended; added may have more
+        // vertices than base. The edges of a vertex keep their base order and
+        // are followed by its added ones. edge_order, if given, receives for
+        // every new edge id either its base id or base edge count plus its id in added.
+        CompactGraph(const CompactGraph& base, const DirectedWeightedGraph<Weight>& added, std::vector<EdgeId>* edge_order = nullptr);
+        // Restores a graph written by Save without copying it.
+        explicit CompactGraph(Snapshot::Reader& reader);
+
+        void Save(Snapshot::Writer& writer) const;
+
+        size_t GetVertexCount() const { return offsets_.size() - 1; }
+        size_t GetEdgeCount() const { return targets_.size(); }
+
+        VertexId GetEdgeFrom(EdgeId edge_id) const { return sources_[edge_id]; }
+        VertexId GetEdgeTo(EdgeId edge_id) const { return targets_[edge_id]; }
+        Weight GetEdgeWeight(EdgeId edge_id) const { return weights_[edge_id]; }
+        Edge<Weight> GetEdge(EdgeId edge_id) const {
+            return {sources_[edge_id], targets_[edge_id], weights_[edge_id]};
+        }
+
+        IncidentEdgesRange GetIncidentEdges(VertexId vertex) const {
+            return {EdgeIdIterator(offsets_[vertex]), EdgeIdIterator(offsets_[vertex + 1])};
+        }
+
+    private:
+        Snapshot::SharedArray<uint32_t> offsets_;
+        Snapshot::SharedArray<uint32_t> targets_;
+        Snapshot::SharedArray<Weight> weights_;
+        Snapshot::SharedArray<uint32_t> sources_;
+    };
+
+
+    template <typename Weight>
+    CompactGraph<Weight>::CompactGraph(const DirectedWeightedGraph<Weight>& graph, std::vector<EdgeId>* edge_order) {
+        std::vector<uint32_t> offsets(graph.GetVertexCount() + 1, 0);
+        std::vector<uint32_t> targets(graph.GetEdgeCount());
+        std::vector<Weight> weights(graph.GetEdgeCount());
+        std::vector<uint32_t> sources(graph.GetEdgeCount());
+        if (edge_order) {
+            edge_order->resize(graph.GetEdgeCount());
+        }
+        EdgeId edge_id = 0;
+        for (VertexId vertex = 0; vertex < graph.GetVertexCount(); ++vertex) {
+            offsets[vertex] = edge_id;
+            for (const EdgeId source_edge_id : graph.GetIncidentEdges(vertex)) {
+                const auto& edge = graph.GetEdge(source_edge_id);
+                sources[edge_id] = edge.from;
+                targets[edge_id] = edge.to;
+                weights[edge_id] = edge.weight;
+                if (edge_order) {
+                    (*edge_order)[edge_id] = source_edge_id;
+                }
+                ++edge_id;
+            }
+        }
+        offsets.back() = edge_id;
+        offsets_ = Snapshot::SharedArray<uint32_t>(std::move(offsets));
+        targets_ = Snapshot::SharedArray<uint32_t>(std::move(targets));
+        weights_ = Snapshot::SharedArray<Weight>(std::move(weights));
+        sources_ = Snapshot::SharedArray<uint32_t>(std::move(sources));
+    }
+
+    template <typename Weight>
+    CompactGraph<Weight>::CompactGraph(const CompactGraph& base, const DirectedWeightedGraph<Weight>& added, std::vector<EdgeId>* edge_order) {
+        const size_t vertex_count = std::max(base.GetVertexCount(), added.GetVertexCount());
+        const size_t edge_count = base.GetEdgeCount() + added.GetEdgeCount();
+        std::vector<uint32_t> offsets(vertex_count + 1, 0);
+        std::vector<uint32_t> targets(edge_count);
+        std::vector<Weight> weights(edge_count);
+        std::vector<uint32_t> sources(edge_count);
+        if (edge_order) {
+            edge_order->resize(edge_count);
+        }
+        EdgeId edge_id = 0;
+        const auto add_edge = [&](const Edge<Weight>& edge, EdgeId order) {
+            sources[edge_id] = edge.from;
+            targets[edge_id] = edge.to;
+            weights[edge_id] = edge.weight;
+            if (edge_order) {
+                (*edge_order)[edge_id] = order;
+            }
+            ++edge_id;
+        };
+        for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+            offsets[vertex] = edge_id;
+            if (vertex < base.GetVertexCount()) {
+                for (const EdgeId base_edge_id : base.GetIncidentEdges(vertex)) {
+                    add_edge(base.GetEdge(base_edge_id), base_edge_id);
+                }
+            }
+            if (vertex < added.GetVertexCount()) {
+                for (const EdgeId added_edge_id : added.GetIncidentEdges(vertex)) {
+                    add_edge(added.GetEdge(added_edge_id), base.GetEdgeCount() + added_edge_id);
+                }
+            }
+        }
+        offsets.back() = edge_id;
+        offsets_ = Snapshot::SharedArray<uint32_t>(std::move(offsets));
+        targets_ = Snapshot::SharedArray<uint32_t>(std::move(targets));
+        weights_ = Snapshot::SharedArray<Weight>(std::move(weights));
+        sources_ = Snapshot::SharedArray<uint32_t>(std::move(sources));
+    }
+
+    template <typename Weight>
+    CompactGraph<Weight>::CompactGraph(Snapshot::Reader& reader)
+        : offsets_(reader.ReadShared<uint32_t>()),
+        targets_(reader.ReadShared<uint32_t>()),
+        weights_(reader.ReadShared<Weight>()),
+        sources_(reader.ReadShared<uint32_t>())
+    {
+        if (offsets_.empty() || offsets_[0] != 0 || targets_.size() != offsets_.back()
+                || weights_.size() != targets_.size() || sources_.size() != targets_.size()) {
+            throw std::runtime_error("snapshot: inconsistent graph");
+        }
+        // Linear in the graph, unlike the router tables that follow it.
+        const size_t vertex_count = GetVertexCount();
+        for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+            if (offsets_[vertex] > offsets_[vertex + 1]) {
+                throw std::runtime_error("snapshot: inconsistent graph");
+            }
+            for (EdgeId edge_id = offsets_[vertex]; edge_id < offsets_[vertex + 1]; ++edge_id) {
+                if (sources_[edge_id] != vertex || targets_[edge_id] >= vertex_count) {
+                    throw std::runtime_error("snapshot: inconsistent graph");
+                }
+            }
+        }
+    }
+
+    template <typename Weight>
+    void CompactGraph<Weight>::Save(Snapshot::Writer& writer) const {
+        writer.WriteVector(offsets_);
+        writer.WriteVector(targets_);
+        writer.WriteVector(weights_);
+        writer.WriteVector(sources_);
+    }
 }
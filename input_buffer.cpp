@@ -0,0 +1,62 @@
+#include "input_buffer.h"
+
+#include <fstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace Input {
+
+    Buffer ReadStream(istream& input) {
+        auto buffer = make_shared<string>();
+        char chunk[1 << 16];
+        while (input.read(chunk, sizeof(chunk)) || input.gcount() > 0) {
+            buffer->append(chunk, input.gcount());
+        }
+        const size_t size = buffer->size();
+        const char* data = buffer->data();
+        return {shared_ptr<const char>(move(buffer), data), size};
+    }
+
+    Buffer ReadFile(const string& path) {
+#ifndef _WIN32
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("cannot open " + path);
+        }
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0) {
+            close(fd);
+            throw runtime_error("cannot stat " + path);
+        }
+        const size_t size = file_stat.st_size;
+        if (size == 0) {
+            close(fd);
+            return {};
+        }
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            throw runtime_error("cannot map " + path);
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+        return {shared_ptr<const char>(static_cast<const char*>(data), [size](const char* mapped) {
+            munmap(const_cast<char*>(mapped), size);
+        }), size};
+#else
+        ifstream input(path, ios::binary);
+        if (!input) {
+            throw runtime_error("cannot open " + path);
+        }
+        return ReadStream(input);
+#endif
+    }
+
+}
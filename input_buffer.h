@@ -0,0 +1,23 @@
+#pragma once
+
+#include <istream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Whole inputs held in memory, for the JSON parsers and the snapshot reader.
+namespace Input {
+
+    // Input bytes kept alive for as long as anything refers to them.
+    struct Buffer {
+        std::shared_ptr<const char> data;
+        size_t size = 0;
+
+        std::string_view GetText() const { return {data.get(), size}; }
+    };
+
+    Buffer ReadStream(std::istream& input);
+    // Maps the file into memory where the platform allows it.
+    Buffer ReadFile(const std::string& path);
+
+}
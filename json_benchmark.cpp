@@ -0,0 +1,194 @@
+#include "Json.h"
+#include "JsonView.h"
+#include "profile.h"
+
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+
+// Build: g++ -std=c++17 -O2 -pthread json_benchmark.cpp Json.cpp JsonView.cpp input_buffer.cpp
+// Run:   ./a.out [input.json]
+// Without an input file a feed of about 30 MB is generated.
+
+// The istream >> char parser the buffer parser replaced, kept as the reference.
+namespace Baseline {
+
+    using Json::Node;
+
+    Node LoadNode(istream& input);
+
+    Node LoadArray(istream& input) {
+        vector<Node> result;
+
+        for (char c; input >> c && c != ']'; ) {
+            if (c != ',') {
+                input.putback(c);
+            }
+            result.push_back(LoadNode(input));
+        }
+
+        return Node(move(result));
+    }
+
+    Node LoadNumber(istream& input) {
+        double result;
+        input >> result;
+        return Node(result);
+    }
+
+    Node LoadString(istream& input) {
+        string line;
+        getline(input, line, '"');
+        return Node(move(line));
+    }
+
+    Node LoadBool(istream& input) {
+        string line;
+        char c;
+        for (int i = 0; i < 4; ++i) {
+            input >> c;
+            line.push_back(c);
+        }
+        if (line == "true")
+            return Node(true);
+        input >> c;
+        return Node(false);
+    }
+
+    Node LoadDict(istream& input) {
+        map<string, Node> result;
+
+        for (char c; input >> c && c != '}'; ) {
+            if (c == ',') {
+                input >> c;
+            }
+
+            string key = LoadString(input).AsString();
+            input >> c;
+            result.emplace(move(key), LoadNode(input));
+        }
+
+        return Node(move(result));
+    }
+
+    Node LoadNode(istream& input) {
+        char c;
+        input >> c;
+
+        if (c == '[') {
+            return LoadArray(input);
+        } else if (c == '{') {
+            return LoadDict(input);
+        } else if (c == '"') {
+            return LoadString(input);
+        } else if (c == 't' || c == 'f') {
+            input.putback(c);
+            return LoadBool(input);
+        } else {
+            input.putback(c);
+            return LoadNumber(input);
+        }
+    }
+
+}
+
+// Stops with road distances to their neighbours and buses through them,
+// shaped like a real base_requests feed.
+string MakeFeed(size_t stop_count, size_t bus_count, size_t stops_per_bus) {
+    mt19937 random(42);
+    ostringstream out;
+    out.precision(10);
+    out << "{\"routing_settings\": {\"bus_wait_time\": 6, \"bus_velocity\": 40}, \"base_requests\": [";
+    for (size_t stop = 0; stop < stop_count; ++stop) {
+        out << (stop ? ", " : "") << "{\"type\": \"Stop\", \"name\": \"Stop " << stop << "\", "
+            << "\"latitude\": " << 55.5 + (random() % 1000000) / 1e6 << ", "
+            << "\"longitude\": " << 37.3 + (random() % 1000000) / 1e6 << ", "
+            << "\"road_distances\": {";
+        for (size_t neighbour = 1; neighbour <= 4; ++neighbour) {
+            out << (neighbour > 1 ? ", " : "") << "\"Stop " << (stop + neighbour) % stop_count << "\": "
+                << 100 + random() % 5000;
+        }
+        out << "}}";
+    }
+    for (size_t bus = 0; bus < bus_count; ++bus) {
+        out << ", {\"type\": \"Bus\", \"name\": \"" << bus << "\", \"is_roundtrip\": "
+            << (bus % 2 ? "true" : "false") << ", \"stops\": [";
+        for (size_t stop = 0; stop < stops_per_bus; ++stop) {
+            out << (stop ? ", " : "") << "\"Stop " << random() % stop_count << "\"";
+        }
+        out << "]}";
+    }
+    out << "], \"stat_requests\": [";
+    for (size_t request = 0; request < stop_count; ++request) {
+        out << (request ? ", " : "") << "{\"id\": " << request << ", \"type\": \"Route\", "
+            << "\"from\": \"Stop " << random() % stop_count << "\", \"to\": \"Stop " << random() % stop_count << "\"}";
+    }
+    out << "]}";
+    return out.str();
+}
+
+// Enough of the document to tell the parsers agree: request counts and the
+// sum of stop latitudes.
+struct Summary {
+    size_t base_request_count;
+    size_t stat_request_count;
+    double latitude_sum;
+
+    bool operator==(const Summary& other) const {
+        return base_request_count == other.base_request_count
+            && stat_request_count == other.stat_request_count
+            && latitude_sum == other.latitude_sum;
+    }
+};
+
+Summary Summarize(const Json::Node& root) {
+    const auto& base_requests = root.AsMap().at("base_requests").AsArray();
+    Summary summary{base_requests.size(), root.AsMap().at("stat_requests").AsArray().size(), 0};
+    for (const auto& request : base_requests) {
+        if (request.AsMap().at("type").AsString() == "Stop") {
+            summary.latitude_sum += request.AsMap().at("latitude").AsNumber();
+        }
+    }
+    return summary;
+}
+
+int main(int argc, const char* argv[]) {
+    string text;
+    if (argc > 1) {
+        ifstream input(argv[1], ios::binary);
+        text.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+    } else {
+        text = MakeFeed(60000, 6000, 200);
+    }
+    cerr << "Input: " << text.size() / (1 << 20) << " MB" << endl;
+
+    Summary baseline_summary;
+    {
+        istringstream input(text);
+        LOG_DURATION("istream >> char parser");
+        baseline_summary = Summarize(Baseline::LoadNode(input));
+    }
+    Summary stream_summary;
+    {
+        istringstream input(text);
+        LOG_DURATION("Json::Load(istream&)");
+        stream_summary = Summarize(Json::Load(input).GetRoot());
+    }
+    Summary buffer_summary;
+    {
+        LOG_DURATION("Json::Load(string_view)");
+        buffer_summary = Summarize(Json::Load(string_view(text)).GetRoot());
+    }
+    {
+        string copy = text;
+        LOG_DURATION("Json::View::Load(string)");
+        const auto document = Json::View::Load(move(copy));
+    }
+
+    if (!(stream_summary == baseline_summary) || !(buffer_summary == baseline_summary)) {
+        cerr << "Parsers disagree on the document" << endl;
+        return 1;
+    }
+    return 0;
+}
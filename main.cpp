@@ -1,10 +1,18 @@
 #include "Manager.h"
 #include <iostream>
 #include <fstream>
-#include "Json.h"
+#include "JsonView.h"
 #include "graph.h"
 #include "router.h"
 #include <numeric>
+#include <cmath>
+#include <charconv>
+#include <cstdio>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
 #include <fstream>
 
 using namespace std;
@@ -73,12 +81,15 @@ struct Request {
         BUS_INFO,
         STOP_INFO,
         ROUTE_INFO,
+        ROUTE_MATRIX,
+        ISOCHRONE,
+        PARETO_ROUTE,
         MAP,
     };
 
     Request(Type type) : type(type) {}
     static RequestHolder Create(Type type);
-    virtual void ParseFrom(Json::Node input) = 0;
+    virtual void ParseFrom(const Json::View::Node& input) = 0;
     virtual ~Request() = default;
 
     const Type type;
@@ -93,11 +104,28 @@ const unordered_map<string_view, Request::Type> STR_TO_OUTPUT_REQUEST_TYPE = {
     {"Bus", Request::Type::BUS_INFO},
     {"Stop", Request::Type::STOP_INFO},
     {"Route", Request::Type::ROUTE_INFO},
+    {"RouteMatrix", Request::Type::ROUTE_MATRIX},
+    {"Isochrone", Request::Type::ISOCHRONE},
+    {"ParetoRoute", Request::Type::PARETO_ROUTE},
     {"Map", Request::Type::MAP},
 };
 
+const unordered_map<string_view, Graph::RouterType> STR_TO_ROUTER_TYPE = {
+    {"all_pairs", Graph::RouterType::ALL_PAIRS},
+    {"dijkstra", Graph::RouterType::DIJKSTRA},
+    {"contraction_hierarchies", Graph::RouterType::CONTRACTION_HIERARCHIES},
+};
+
+Graph::RouterType ReadRouterType(const Json::View::Object& settings) {
+    if (const auto it = settings.find("router"); it != settings.end()) {
+        return STR_TO_ROUTER_TYPE.at(it->second.AsString());
+    }
+    return Graph::RouterType::ALL_PAIRS;
+}
+
 struct Response {
     Response(const Request::Type type_) : type(type_) {}
+    virtual ~Response() = default;
     const Request::Type type;
     uint64_t respones_id;
     string error_message;
@@ -106,7 +134,7 @@ struct Response {
 struct StopResponse : public Response {
     StopResponse() : Response(Request::Type::STOP_INFO) {}
     string name;
-    set<string_view> buses_for_stop;
+    vector<string_view> buses_for_stop;
 };
 
 struct BusResponse : public Response {
@@ -129,6 +157,52 @@ struct RouteResponse : public Response {
     vector<Item> items;
     string svg;
     double total_time;
+    struct Alternative {
+        double total_time;
+        vector<Item> items;
+    };
+    // Filled instead of items and total_time when alternatives were asked
+    // for; svg then shows all of them.
+    vector<Alternative> alternatives;
+};
+
+RouteResponse::Item MakeResponseItem(const RouteItem& item) {
+    return {
+        item.type == RouteItemType::WAIT ? "Wait" : "Bus",
+        string(item.name),
+        item.time,
+        item.span_count,
+    };
+}
+
+struct RouteMatrixResponse : public Response {
+    RouteMatrixResponse() : Response(Request::Type::ROUTE_MATRIX) {}
+    // By origin, then by destination; nullopt where there is no route.
+    vector<vector<optional<double>>> times;
+    // Same shape as times, or empty when items were not asked for.
+    vector<vector<vector<RouteResponse::Item>>> items;
+};
+
+struct IsochroneResponse : public Response {
+    IsochroneResponse() : Response(Request::Type::ISOCHRONE) {}
+    struct Item {
+        string_view stop_name;
+        double time;
+    };
+    vector<Item> stops;
+    // Empty unless the map was asked for.
+    string svg;
+};
+
+struct ParetoRouteResponse : public Response {
+    ParetoRouteResponse() : Response(Request::Type::PARETO_ROUTE) {}
+    struct Route {
+        double total_time;
+        size_t transfer_count;
+        vector<RouteResponse::Item> items;
+    };
+    // Fastest first; every next one has fewer transfers.
+    vector<Route> routes;
 };
 
 struct MapResponse : public Response {
@@ -154,14 +228,14 @@ struct ModifyRequest : Request {
 struct AddStopRequest : ModifyRequest {
     AddStopRequest() : ModifyRequest(Type::ADD_STOP) {}
     
-    void ParseFrom(Json::Node input) override {
+    void ParseFrom(const Json::View::Node& input) override {
         name = input.AsMap().at("name").AsString();
         coordinate = {
             input.AsMap().at("latitude").AsNumber(),
             input.AsMap().at("longitude").AsNumber()
         };
         for (const auto& stop : input.AsMap().at("road_distances").AsMap())
-            distances[stop.first] = stop.second.AsNumber();
+            distances[string(stop.first)] = stop.second.AsNumber();
     }
 
     void Process(TransportManager& manager) const override {
@@ -178,26 +252,38 @@ private:
 struct AddBusRequest : ModifyRequest {
     AddBusRequest() : ModifyRequest(Type::ADD_BUS) {}
 
-    void ParseFrom(Json::Node input) override {
+    void ParseFrom(const Json::View::Node& input) override {
         name = input.AsMap().at("name").AsString();
         is_reversed = !input.AsMap().at("is_roundtrip").AsBool();
         for (const auto& stop : input.AsMap().at("stops").AsArray())
-            stops.push_back(stop.AsString());
+            stops.emplace_back(stop.AsString());
+        // Optional stop times in minutes, one array per trip over the route in riding order.
+        if (const auto it = input.AsMap().find("trips"); it != input.AsMap().end()) {
+            for (const auto& trip : it->second.AsArray()) {
+                auto& times = trips.emplace_back();
+                for (const auto& time : trip.AsArray())
+                    times.push_back(time.AsNumber());
+            }
+        }
     }
 
     void Process(TransportManager& manager) const override {
         manager.AddBus(name, stops, is_reversed);
+        if (!trips.empty()) {
+            manager.SetBusTimetable(name, trips);
+        }
     }
 private:
     string name;
     vector<string> stops;
     bool is_reversed = false;
+    vector<vector<double>> trips;
 };
 
 struct BusInfoRequest : ReadRequest<unique_ptr<BusResponse>> {
     BusInfoRequest() : ReadRequest<unique_ptr<BusResponse>>(Type::BUS_INFO) {}
 
-    void ParseFrom(Json::Node input) override {
+    void ParseFrom(const Json::View::Node& input) override {
         name = input.AsMap().at("name").AsString();
         request_id = input.AsMap().at("id").AsNumber();
     }
@@ -206,15 +292,16 @@ struct BusInfoRequest : ReadRequest<unique_ptr<BusResponse>> {
         unique_ptr<BusResponse> response = make_unique<BusResponse>();
         response->name = name;
         response->respones_id = request_id;
-        const auto& bus = manager.GetBus(name);
+        const Bus* bus = manager.FindBus(name);
         if (bus == nullptr) {
             response->error_message = "not found";
             return move(response);
         }
-        response->real_route_length = bus->GetLength(manager);
-        response->curvature = response->real_route_length / bus->GetGeographicDistance(manager);
-        response->stops_num = bus->GetStopsNum();
-        response->unique_stops_num = bus->GetUniqueStopsNum();
+        const BusStats stats = manager.GetBusStats(bus->GetId());
+        response->real_route_length = stats.route_length;
+        response->curvature = stats.curvature;
+        response->stops_num = stats.stop_count;
+        response->unique_stops_num = stats.unique_stop_count;
         return move(response);
     }
 private:
@@ -224,26 +311,24 @@ private:
 struct StopInfoRequest : ReadRequest<unique_ptr<StopResponse>> {
     StopInfoRequest() : ReadRequest<unique_ptr<StopResponse>>(Type::STOP_INFO) {}
 
-    void ParseFrom(Json::Node input) override {
+    void ParseFrom(const Json::View::Node& input) override {
         name = input.AsMap().at("name").AsString();
         request_id = input.AsMap().at("id").AsNumber();
     }
 
     unique_ptr<StopResponse> Process(const TransportManager& manager) const override {
         unique_ptr<StopResponse> response = make_unique<StopResponse>();
-        const auto& stop = manager.GetStop(name);
+        const Stop* stop = manager.FindStop(name);
         response->name = name;
         response->respones_id = request_id;
         if (stop == nullptr) {
             response->error_message = "not found";
             return move(response);
         }
-        const auto& buses_from_manager = manager.GetBuses();
-        set<string_view> buses_for_stop;
-        for (const auto& bus : buses_from_manager)
-            if (bus.second->Find(name))
-                buses_for_stop.insert(bus.first);
-        response->buses_for_stop = buses_for_stop;
+        const auto& buses_for_stop = manager.GetStopBuses(stop->GetId());
+        response->buses_for_stop.reserve(buses_for_stop.size());
+        for (const BusId bus : buses_for_stop)
+            response->buses_for_stop.push_back(manager.GetBus(bus)->GetName());
         return move(response);
     }
 private:
@@ -253,39 +338,211 @@ private:
 struct RouteInfoRequest : ReadRequest<unique_ptr<RouteResponse>> {
     RouteInfoRequest() : ReadRequest<unique_ptr<RouteResponse>>(Type::ROUTE_INFO) {}
 
-    void ParseFrom(Json::Node input) override {
+    void ParseFrom(const Json::View::Node& input) override {
         request_id = input.AsMap().at("id").AsNumber();
         from = input.AsMap().at("from").AsString();
         to = input.AsMap().at("to").AsString();;
+        if (const auto it = input.AsMap().find("departure_time"); it != input.AsMap().end()) {
+            departure_time = it->second.AsNumber();
+        }
+        if (const auto it = input.AsMap().find("alternatives"); it != input.AsMap().end()) {
+            const double count = it->second.AsNumber();
+            if (count != floor(count)) {
+                std::stringstream error;
+                error << "alternatives " << count << " is not an integer";
+                throw invalid_argument(error.str());
+            }
+            alternative_count = static_cast<size_t>(clamp(count, 0.0, static_cast<double>(MAX_ALTERNATIVES)));
+        }
     }
 
     unique_ptr<RouteResponse> Process(const TransportManager& manager) const override {
+        if (alternative_count > 0) {
+            return MakeAlternativesResponse(manager.GetAlternativeRoutes(from, to, alternative_count));
+        }
+        if (departure_time) {
+            return MakeResponse(manager.GetRoute(from, to, *departure_time));
+        }
+        return MakeResponse(manager.GetRoute(from, to));
+    }
+
+    // For requests answered together through TransportManager::GetRoutes.
+    unique_ptr<RouteResponse> MakeResponse(const pair<string, vector<RouteItem>>& route_info_items) const {
         unique_ptr<RouteResponse> response = make_unique<RouteResponse>();
-        auto route_info_items = manager.GetRoute(from, to);
         response->total_time = 0;
         if (route_info_items.second.empty() && (from != to)) response->error_message = "not found";
         for (const auto& item : route_info_items.second) {
-            response->total_time += item.weight;
-            response->items.push_back({
-                    item.type,
-                    item.text,
-                    item.weight,
-                    item.stop_count,
-                });
+            response->total_time += item.time;
+            response->items.push_back(MakeResponseItem(item));
         }
         response->svg = route_info_items.first;
         response->respones_id = request_id;
         return move(response);
     }
+
+    string_view GetFrom() const { return from; }
+
+    string_view GetTo() const { return to; }
+
+    // Timed routes follow the timetables and alternatives come from their own
+    // search, so neither is grouped.
+    bool IsGroupable() const { return !departure_time && alternative_count == 0; }
 private:
+    // More alternatives are cut down to this many.
+    static constexpr size_t MAX_ALTERNATIVES = 16;
+
     string from, to;
+    optional<double> departure_time;
+    size_t alternative_count = 0;
+
+    unique_ptr<RouteResponse> MakeAlternativesResponse(const pair<string, vector<vector<RouteItem>>>& routes) const {
+        unique_ptr<RouteResponse> response = make_unique<RouteResponse>();
+        response->respones_id = request_id;
+        if (routes.second.empty()) {
+            response->error_message = "not found";
+            return response;
+        }
+        for (const auto& route : routes.second) {
+            auto& alternative = response->alternatives.emplace_back();
+            alternative.total_time = 0;
+            for (const auto& item : route) {
+                alternative.total_time += item.time;
+                alternative.items.push_back(MakeResponseItem(item));
+            }
+        }
+        response->svg = routes.first;
+        return response;
+    }
 
 };
 
+// Travel times from every stop of "from" to every stop of "to", with one
+// routing search per origin; "with_items" adds the items of every route.
+struct RouteMatrixRequest : ReadRequest<unique_ptr<RouteMatrixResponse>> {
+    RouteMatrixRequest() : ReadRequest<unique_ptr<RouteMatrixResponse>>(Type::ROUTE_MATRIX) {}
+
+    void ParseFrom(const Json::View::Node& input) override {
+        const auto request = input.AsMap();
+        request_id = request.at("id").AsNumber();
+        for (const auto& stop : request.at("from").AsArray())
+            from.emplace_back(stop.AsString());
+        for (const auto& stop : request.at("to").AsArray())
+            to.emplace_back(stop.AsString());
+        if (const auto it = request.find("with_items"); it != request.end()) {
+            with_items = it->second.AsBool();
+        }
+    }
+
+    unique_ptr<RouteMatrixResponse> Process(const TransportManager& manager) const override {
+        unique_ptr<RouteMatrixResponse> response = make_unique<RouteMatrixResponse>();
+        response->respones_id = request_id;
+        vector<string_view> from_names(from.begin(), from.end());
+        vector<string_view> to_names(to.begin(), to.end());
+        for (const auto names : {&from_names, &to_names}) {
+            for (const auto name : *names) {
+                if (!manager.FindStop(name)) {
+                    response->error_message = "not found";
+                    return response;
+                }
+            }
+        }
+        auto matrix = manager.GetRouteMatrix(from_names, to_names, with_items);
+        response->times = move(matrix.times);
+        for (const auto& row : matrix.items) {
+            auto& response_row = response->items.emplace_back();
+            for (const auto& route : row) {
+                auto& response_items = response_row.emplace_back();
+                for (const auto& item : route) {
+                    response_items.push_back(MakeResponseItem(item));
+                }
+            }
+        }
+        return response;
+    }
+private:
+    vector<string> from, to;
+    bool with_items = false;
+};
+
+// Stops reachable from "from" within "max_time" minutes; "with_map" adds
+// them drawn over the map.
+struct IsochroneRequest : ReadRequest<unique_ptr<IsochroneResponse>> {
+    IsochroneRequest() : ReadRequest<unique_ptr<IsochroneResponse>>(Type::ISOCHRONE) {}
+
+    void ParseFrom(const Json::View::Node& input) override {
+        const auto request = input.AsMap();
+        request_id = request.at("id").AsNumber();
+        from = request.at("from").AsString();
+        max_time = request.at("max_time").AsNumber();
+        if (const auto it = request.find("with_map"); it != request.end()) {
+            with_map = it->second.AsBool();
+        }
+    }
+
+    unique_ptr<IsochroneResponse> Process(const TransportManager& manager) const override {
+        unique_ptr<IsochroneResponse> response = make_unique<IsochroneResponse>();
+        response->respones_id = request_id;
+        if (!manager.FindStop(from)) {
+            response->error_message = "not found";
+            return response;
+        }
+        const auto reachable_stops = manager.GetReachableStops(from, max_time);
+        response->stops.reserve(reachable_stops.size());
+        for (const auto& reachable : reachable_stops) {
+            response->stops.push_back({ reachable.stop->GetName(), reachable.time });
+        }
+        if (with_map) {
+            response->svg = manager.RenderReachableStops(reachable_stops, max_time);
+        }
+        return response;
+    }
+private:
+    string from;
+    double max_time = 0;
+    bool with_map = false;
+};
+
+// Every route from "from" to "to" that no other one beats on both travel
+// time and transfers.
+struct ParetoRouteRequest : ReadRequest<unique_ptr<ParetoRouteResponse>> {
+    ParetoRouteRequest() : ReadRequest<unique_ptr<ParetoRouteResponse>>(Type::PARETO_ROUTE) {}
+
+    void ParseFrom(const Json::View::Node& input) override {
+        request_id = input.AsMap().at("id").AsNumber();
+        from = input.AsMap().at("from").AsString();
+        to = input.AsMap().at("to").AsString();
+    }
+
+    unique_ptr<ParetoRouteResponse> Process(const TransportManager& manager) const override {
+        unique_ptr<ParetoRouteResponse> response = make_unique<ParetoRouteResponse>();
+        response->respones_id = request_id;
+        if (!manager.FindStop(from) || !manager.FindStop(to)) {
+            response->error_message = "not found";
+            return response;
+        }
+        const auto routes = manager.GetParetoRoutes(from, to);
+        if (routes.empty()) {
+            response->error_message = "not found";
+            return response;
+        }
+        for (const auto& route : routes) {
+            auto& response_route = response->routes.emplace_back();
+            response_route.total_time = route.time;
+            response_route.transfer_count = route.transfer_count;
+            for (const auto& item : route.items) {
+                response_route.items.push_back(MakeResponseItem(item));
+            }
+        }
+        return response;
+    }
+private:
+    string from, to;
+};
+
 struct MapRequest : ReadRequest<unique_ptr<MapResponse>> {
     MapRequest() : ReadRequest<unique_ptr<MapResponse>>(Type::MAP) {}
 
-    void ParseFrom(Json::Node input) override {
+    void ParseFrom(const Json::View::Node& input) override {
         request_id = input.AsMap().at("id").AsNumber();
     }
 
@@ -313,6 +570,12 @@ RequestHolder Request::Create(Request::Type type) {
         return make_unique<StopInfoRequest>();
     case Request::Type::ROUTE_INFO:
         return make_unique<RouteInfoRequest>();
+    case Request::Type::ROUTE_MATRIX:
+        return make_unique<RouteMatrixRequest>();
+    case Request::Type::ISOCHRONE:
+        return make_unique<IsochroneRequest>();
+    case Request::Type::PARETO_ROUTE:
+        return make_unique<ParetoRouteRequest>();
     case Request::Type::MAP:
         return make_unique<MapRequest>();
     default:
@@ -339,7 +602,7 @@ optional<Request::Type> ConvertRequestTypeFromString(string_view type_str, const
     }
 }
 
-RequestHolder ParseInputRequest(Json::Node request_node) {
+RequestHolder ParseInputRequest(const Json::View::Node& request_node) {
     const auto request_type = ConvertRequestTypeFromString(request_node.AsMap().at("type").AsString(), STR_TO_INPUT_REQUEST_TYPE);
     if (!request_type) {
         return nullptr;
@@ -351,7 +614,7 @@ RequestHolder ParseInputRequest(Json::Node request_node) {
     return request;
 }
 
-RequestHolder ParseOutputRequest(Json::Node request_node) {
+RequestHolder ParseOutputRequest(const Json::View::Node& request_node) {
     const auto request_type = ConvertRequestTypeFromString(request_node.AsMap().at("type").AsString(), STR_TO_OUTPUT_REQUEST_TYPE);
     if (!request_type) {
         return nullptr;
@@ -363,132 +626,648 @@ RequestHolder ParseOutputRequest(Json::Node request_node) {
     return request;
 }
 
-vector<RequestHolder> ReadRequests(const function<RequestHolder(Json::Node)>& ParseRequest, Json::Node in) {
-    const size_t request_count = in.AsArray().size();
+// Serialises responses as soon as they are computed. Output goes through a
+// bounded buffer that is handed to the stream in large writes and flushed
+// only at the end; the layout is the same as the one-shot printer produced.
+class ResponseWriter {
+public:
+    explicit ResponseWriter(ostream& stream, size_t buffer_capacity = 1 << 16) :
+        stream_(stream),
+        buffer_capacity_(buffer_capacity)
+    {
+        buffer_.reserve(buffer_capacity_);
+        Append("[\n");
+    }
+
+    ResponseWriter(const ResponseWriter&) = delete;
+    ResponseWriter& operator=(const ResponseWriter&) = delete;
+
+    void Write(const Response& response_holder) {
+        Append(response_counter_ ? ",\n\t{\n" : "\t{\n");
+        ++response_counter_;
+        Append("\t\t\"request_id\": ");
+        Append(response_holder.respones_id);
+        Append(",\n");
+        if (!response_holder.error_message.empty()) {
+            Append("\t\t\"error_message\": \"");
+            Append(response_holder.error_message);
+            Append("\"\n");
+        }
+        else if (response_holder.type == Request::Type::STOP_INFO) {
+            const auto& response = static_cast<const StopResponse&>(response_holder);
+            Append("\t\t\"buses\": [");
+            size_t bus_counter = 0;
+            for (const auto& bus : response.buses_for_stop) {
+                Append("\n\t\t\t\"");
+                Append(bus);
+                Append("\"");
+                bus_counter++;
+                if (bus_counter != response.buses_for_stop.size())
+                    Append(",");
+            }
+            if (response.buses_for_stop.size()) Append("\n");
+            Append("\t\t]\n");
+        }
+        else if (response_holder.type == Request::Type::BUS_INFO) {
+            const auto& response = static_cast<const BusResponse&>(response_holder);
+            Append("\t\t\"stop_count\": ");
+            Append(response.stops_num);
+            Append(",\n\t\t\"unique_stop_count\": ");
+            Append(response.unique_stops_num);
+            Append(",\n\t\t\"route_length\": ");
+            Append(response.real_route_length);
+            Append(",\n\t\t\"curvature\": ");
+            Append(response.curvature);
+            Append("\n");
+        }
+        else if (response_holder.type == Request::Type::ROUTE_INFO) {
+            const auto& response = static_cast<const RouteResponse&>(response_holder);
+            if (!response.alternatives.empty()) {
+                Append("\t\t\"routes\": [\n");
+                for (size_t idx = 0; idx < response.alternatives.size(); ++idx) {
+                    const auto& alternative = response.alternatives[idx];
+                    Append("\t\t\t{\n\t\t\t\t\"total_time\": ");
+                    Append(alternative.total_time);
+                    Append(",\n\t\t\t\t\"items\": [\n");
+                    AppendItems(alternative.items, "\t\t\t\t");
+                    Append("\t\t\t\t]\n");
+                    Append(idx + 1 != response.alternatives.size() ? "\t\t\t},\n" : "\t\t\t}\n");
+                }
+                Append("\t\t]");
+            }
+            else {
+                Append("\t\t\"total_time\": ");
+                Append(response.total_time);
+                Append(",\n\t\t\"items\": [\n");
+                AppendItems(response.items, "\t\t");
+                Append("\t\t]");
+            }
+            if (!response.svg.empty()) {
+                Append(",\n\t\t\"map\": ");
+                Append(response.svg);
+            }
+            Append("\n");
+        }
+        else if (response_holder.type == Request::Type::ROUTE_MATRIX) {
+            const auto& response = static_cast<const RouteMatrixResponse&>(response_holder);
+            Append("\t\t\"times\": [\n");
+            for (size_t row = 0; row < response.times.size(); ++row) {
+                Append("\t\t\t[");
+                for (size_t column = 0; column < response.times[row].size(); ++column) {
+                    if (column) Append(", ");
+                    if (const auto time = response.times[row][column]) {
+                        Append(*time);
+                    }
+                    else {
+                        Append("null");
+                    }
+                }
+                Append(row + 1 != response.times.size() ? "],\n" : "]\n");
+            }
+            Append("\t\t]");
+            if (!response.items.empty()) {
+                Append(",\n\t\t\"items\": [\n");
+                for (size_t row = 0; row < response.items.size(); ++row) {
+                    Append("\t\t\t[\n");
+                    for (size_t column = 0; column < response.items[row].size(); ++column) {
+                        Append("\t\t\t\t[\n");
+                        AppendItems(response.items[row][column], "\t\t\t\t");
+                        Append(column + 1 != response.items[row].size() ? "\t\t\t\t],\n" : "\t\t\t\t]\n");
+                    }
+                    Append(row + 1 != response.items.size() ? "\t\t\t],\n" : "\t\t\t]\n");
+                }
+                Append("\t\t]");
+            }
+            Append("\n");
+        }
+        else if (response_holder.type == Request::Type::ISOCHRONE) {
+            const auto& response = static_cast<const IsochroneResponse&>(response_holder);
+            Append("\t\t\"stops\": [");
+            for (size_t idx = 0; idx < response.stops.size(); ++idx) {
+                Append(idx ? ",\n\t\t\t{\"stop_name\": \"" : "\n\t\t\t{\"stop_name\": \"");
+                Append(response.stops[idx].stop_name);
+                Append("\", \"time\": ");
+                Append(response.stops[idx].time);
+                Append("}");
+            }
+            Append(response.stops.empty() ? "]" : "\n\t\t]");
+            if (!response.svg.empty()) {
+                Append(",\n\t\t\"map\": ");
+                Append(response.svg);
+            }
+            Append("\n");
+        }
+        else if (response_holder.type == Request::Type::PARETO_ROUTE) {
+            const auto& response = static_cast<const ParetoRouteResponse&>(response_holder);
+            Append("\t\t\"routes\": [\n");
+            for (size_t idx = 0; idx < response.routes.size(); ++idx) {
+                const auto& route = response.routes[idx];
+                Append("\t\t\t{\n\t\t\t\t\"total_time\": ");
+                Append(route.total_time);
+                Append(",\n\t\t\t\t\"transfer_count\": ");
+                Append(route.transfer_count);
+                Append(",\n\t\t\t\t\"items\": [\n");
+                AppendItems(route.items, "\t\t\t\t");
+                Append("\t\t\t\t]\n");
+                Append(idx + 1 != response.routes.size() ? "\t\t\t},\n" : "\t\t\t}\n");
+            }
+            Append("\t\t]\n");
+        }
+        else if (response_holder.type == Request::Type::MAP) {
+            const auto& response = static_cast<const MapResponse&>(response_holder);
+            Append("\t\t\"map\": ");
+            Append(response.svg);
+            Append("\n");
+        }
+        Append("\t}");
+    }
+
+    // Closes the array and flushes the stream; nothing may be written afterwards.
+    void Finish() {
+        Append(response_counter_ ? "\n]\n" : "]\n");
+        Drain();
+        stream_.flush();
+    }
+
+private:
+    ostream& stream_;
+    const size_t buffer_capacity_;
+    string buffer_;
+    size_t response_counter_ = 0;
 
-    vector<RequestHolder> requests;
-    requests.reserve(request_count);
+    void Drain() {
+        stream_.write(buffer_.data(), buffer_.size());
+        buffer_.clear();
+    }
 
-    for (size_t i = 0; i < request_count; ++i) {
+    // Writes the elements of an items array nested one level below indent.
+    void AppendItems(const vector<RouteResponse::Item>& items, string_view indent) {
+        for (size_t idx = 0; idx < items.size(); ++idx) {
+            const auto& item = items[idx];
+            Append(indent);
+            Append("\t{\n");
+            Append(indent);
+            Append("\t\t\"type\": \"");
+            Append(item.type);
+            Append("\",\n");
+            if (item.type == "Bus") {
+                Append(indent);
+                Append("\t\t\"bus\": \"");
+                Append(item.name);
+                Append("\",\n");
+                Append(indent);
+                Append("\t\t\"span_count\": ");
+                Append(item.span_count);
+                Append(",\n");
+            }
+            else {
+                Append(indent);
+                Append("\t\t\"stop_name\": \"");
+                Append(item.name);
+                Append("\",\n");
+            }
+            Append(indent);
+            Append("\t\t\"time\": ");
+            Append(item.time);
+            Append("\n");
+            Append(indent);
+            Append("\t}");
+            if (idx + 1 != items.size()) Append(",");
+            Append("\n");
+        }
+    }
 
-        if (auto request = ParseRequest(in.AsArray()[i])) {
-            requests.push_back(move(request));
+    void Append(string_view text) {
+        if (buffer_.size() + text.size() > buffer_capacity_) {
+            Drain();
+            // Payloads such as maps can be larger than the whole buffer.
+            if (text.size() > buffer_capacity_) {
+                stream_.write(text.data(), text.size());
+                return;
+            }
         }
+        buffer_.append(text);
+    }
+
+    template <typename Integer, enable_if_t<is_integral_v<Integer>, int> = 0>
+    void Append(Integer value) {
+        char chars[24];
+        const auto result = to_chars(begin(chars), end(chars), value);
+        Append(string_view(chars, result.ptr - chars));
+    }
+
+    // Same digits as operator<< after setprecision(16).
+    void Append(double value) {
+        char chars[32];
+        const int size = snprintf(chars, sizeof(chars), "%.16g", value);
+        Append(string_view(chars, size));
+    }
+};
+
+void ApplyModifyRequest(const Request& request_holder, TransportManager& manager) {
+    if (request_holder.type == Request::Type::ADD_STOP) {
+        const auto& request = static_cast<const AddStopRequest&>(request_holder);
+        request.Process(manager);
+    }
+    else if (request_holder.type == Request::Type::ADD_BUS) {
+        const auto& request = static_cast<const AddBusRequest&>(request_holder);
+        request.Process(manager);
+    }
+}
+
+ResponseHolder ProcessReadRequest(const Request& request_holder, const TransportManager& manager) {
+    if (request_holder.type == Request::Type::BUS_INFO) {
+        const auto& request = static_cast<const BusInfoRequest&>(request_holder);
+        return request.Process(manager);
+    }
+    else if (request_holder.type == Request::Type::STOP_INFO) {
+        const auto& request = static_cast<const StopInfoRequest&>(request_holder);
+        return request.Process(manager);
+    }
+    else if (request_holder.type == Request::Type::ROUTE_INFO) {
+        const auto& request = static_cast<const RouteInfoRequest&>(request_holder);
+        return request.Process(manager);
+    }
+    else if (request_holder.type == Request::Type::ROUTE_MATRIX) {
+        const auto& request = static_cast<const RouteMatrixRequest&>(request_holder);
+        return request.Process(manager);
     }
-    return requests;
+    else if (request_holder.type == Request::Type::ISOCHRONE) {
+        const auto& request = static_cast<const IsochroneRequest&>(request_holder);
+        return request.Process(manager);
+    }
+    else if (request_holder.type == Request::Type::PARETO_ROUTE) {
+        const auto& request = static_cast<const ParetoRouteRequest&>(request_holder);
+        return request.Process(manager);
+    }
+    else if (request_holder.type == Request::Type::MAP) {
+        const auto& request = static_cast<const MapRequest&>(request_holder);
+        return request.Process(manager);
+    }
+    return nullptr;
 }
 
-vector<ResponseHolder> ProcessRequests(const vector<RequestHolder> & requests, TransportManager& manager) {
-    vector<ResponseHolder> responses;
-    for (const auto& request_holder : requests) {
-        if (request_holder->type == Request::Type::ADD_STOP) {
-            const auto& request = static_cast<const AddStopRequest&>(*request_holder);
-            request.Process(manager);
+// Answers stat requests on a pool of worker threads against a built manager.
+// Requests are taken in batches, so memory stays bounded, and the responses of
+// a batch are written in request order once all of them are ready. The calling
+// thread works on every batch too. Route requests of a batch that share an
+// origin are answered together, up to ROUTE_GROUP_SIZE at a time, so that one
+// routing search serves the whole group.
+class StatRequestExecutor {
+public:
+    StatRequestExecutor(const TransportManagerVersions& versions, ResponseWriter& writer,
+                        size_t thread_count = thread::hardware_concurrency(), size_t batch_size = 1 << 12) :
+        versions_(versions),
+        writer_(writer),
+        batch_size_(max<size_t>(batch_size, 1))
+    {
+        requests_.reserve(batch_size_);
+        for (size_t worker = 1; worker < thread_count; ++worker) {
+            workers_.emplace_back([this] { RunWorker(); });
+        }
+    }
+
+    StatRequestExecutor(const StatRequestExecutor&) = delete;
+    StatRequestExecutor& operator=(const StatRequestExecutor&) = delete;
+
+    ~StatRequestExecutor() {
+        {
+            lock_guard lock(mutex_);
+            is_stopping_ = true;
         }
-        else if (request_holder->type == Request::Type::ADD_BUS) {
-            const auto& request = static_cast<const AddBusRequest&>(*request_holder);
-            request.Process(manager);
+        batch_ready_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
         }
-        else if (request_holder->type == Request::Type::BUS_INFO) {
-            const auto& request = static_cast<const BusInfoRequest&>(*request_holder);
-            responses.push_back(request.Process(manager));
+    }
+
+    void Submit(RequestHolder request) {
+        requests_.push_back(move(request));
+        if (requests_.size() == batch_size_) {
+            RunBatch();
+        }
+    }
+
+    // Answers and writes the requests submitted so far.
+    void Flush() {
+        RunBatch();
+    }
+
+private:
+    static constexpr size_t ROUTE_GROUP_SIZE = 64;
+
+    const TransportManagerVersions& versions_;
+    // The version a batch is answered from, taken when the batch starts.
+    shared_ptr<const TransportManager> manager_;
+    ResponseWriter& writer_;
+    const size_t batch_size_;
+
+    vector<RequestHolder> requests_;
+    vector<ResponseHolder> responses_;
+    // Indexes of the requests each worker takes as a whole.
+    vector<vector<size_t>> units_;
+    atomic<size_t> next_unit_ = 0;
+    exception_ptr error_;
+
+    mutex mutex_;
+    condition_variable batch_ready_;
+    condition_variable batch_done_;
+    uint64_t batch_number_ = 0;
+    size_t busy_workers_ = 0;
+    bool is_stopping_ = false;
+    vector<thread> workers_;
+
+    void GroupRequests() {
+        units_.clear();
+        // Origin to the unit that still takes route requests from it.
+        unordered_map<string_view, size_t> route_groups;
+        for (size_t idx = 0; idx < requests_.size(); ++idx) {
+            const auto* request_ptr = requests_[idx]->type == Request::Type::ROUTE_INFO
+                ? static_cast<const RouteInfoRequest*>(requests_[idx].get())
+                : nullptr;
+            if (!request_ptr || !request_ptr->IsGroupable()) {
+                units_.push_back({idx});
+                continue;
+            }
+            const auto& request = *request_ptr;
+            const auto [it, inserted] = route_groups.emplace(request.GetFrom(), units_.size());
+            if (!inserted && units_[it->second].size() < ROUTE_GROUP_SIZE) {
+                units_[it->second].push_back(idx);
+                continue;
+            }
+            it->second = units_.size();
+            units_.push_back({idx});
         }
-        else if (request_holder->type == Request::Type::STOP_INFO) {
-            const auto& request = static_cast<const StopInfoRequest&>(*request_holder);
-            responses.push_back(request.Process(manager));
+    }
+
+    void ProcessUnit(const vector<size_t>& unit) {
+        if (unit.size() == 1) {
+            responses_[unit[0]] = ProcessReadRequest(*requests_[unit[0]], *manager_);
+            return;
         }
-        else if (request_holder->type == Request::Type::ROUTE_INFO) {
-            const auto& request = static_cast<const RouteInfoRequest&>(*request_holder);
-            responses.push_back(request.Process(manager));
+        vector<string_view> destinations;
+        destinations.reserve(unit.size());
+        for (const size_t idx : unit) {
+            destinations.push_back(static_cast<const RouteInfoRequest&>(*requests_[idx]).GetTo());
         }
-        else if (request_holder->type == Request::Type::MAP) {
-            const auto& request = static_cast<const MapRequest&>(*request_holder);
-            responses.push_back(request.Process(manager));
+        const auto& first_request = static_cast<const RouteInfoRequest&>(*requests_[unit[0]]);
+        const auto routes = manager_->GetRoutes(first_request.GetFrom(), destinations);
+        for (size_t i = 0; i < unit.size(); ++i) {
+            responses_[unit[i]] = static_cast<const RouteInfoRequest&>(*requests_[unit[i]]).MakeResponse(routes[i]);
         }
     }
-    return responses;
-}
 
-void PrintResponses(const vector<ResponseHolder> & responses, ostream & stream = cout) {
-    stream << "[" << endl;
-    size_t response_counter = 0;
-    for (const auto& response_holder : responses) {
-        stream << "\t{" << endl;
-        stream << "\t\t\"request_id\": " << response_holder->respones_id << "," << endl;
-        if (!response_holder->error_message.empty()) {
-            stream << "\t\t\"error_message\": \"" << response_holder->error_message << "\"" << endl;
-        } 
-        else if (response_holder->type == Request::Type::STOP_INFO) {
-            const auto& response = static_cast<const StopResponse&>(*response_holder);
-            stream << "\t\t\"buses\": [";
-            size_t bus_counter = 0;
-            for (const auto& bus : response.buses_for_stop) {
-                stream << endl << "\t\t\t\"" << bus << "\"";
-                bus_counter++;
-                if (bus_counter != response.buses_for_stop.size())
-                    stream << ",";
+    void ProcessRequests() {
+        for (size_t unit = next_unit_++; unit < units_.size(); unit = next_unit_++) {
+            try {
+                ProcessUnit(units_[unit]);
             }
-            if (response.buses_for_stop.size()) stream << endl;
-            stream << "\t\t]" << endl;
-        } 
-        else if (response_holder->type == Request::Type::BUS_INFO) {
-            const auto& response = static_cast<const BusResponse&>(*response_holder);
-            stream << "\t\t\"stop_count\": " << response.stops_num << "," << endl;
-            stream << "\t\t\"unique_stop_count\": " << response.unique_stops_num << "," << endl;
-            stream << "\t\t\"route_length\": " << response.real_route_length << "," << endl;
-            stream << "\t\t\"curvature\": " << setprecision(16) << response.curvature << endl;
-        }
-        else if (response_holder->type == Request::Type::ROUTE_INFO) {
-            const auto& response = static_cast<const RouteResponse&>(*response_holder);
-            stream << "\t\t\"total_time\": "  << setprecision(16) << response.total_time << "," << endl;
-            stream << "\t\t\"items\": [" << endl;
-            int items_counter = 0;
-            for (const auto& item : response.items) {
-                stream << "\t\t\t{" << endl;
-                stream << "\t\t\t\t\"type\": \"" << item.type << "\"," << endl;
-                if (item.type == "Bus") {
-                    stream << "\t\t\t\t\"bus\": \"" << item.name << "\"," << endl;
-                    stream << "\t\t\t\t\"span_count\": " << item.span_count << "," << endl;
+            catch (...) {
+                lock_guard lock(mutex_);
+                if (!error_) {
+                    error_ = current_exception();
                 }
-                else {
-                    stream << "\t\t\t\t\"stop_name\": \"" << item.name << "\"," << endl;
+            }
+        }
+    }
+
+    void RunWorker() {
+        uint64_t done_batch_number = 0;
+        while (true) {
+            {
+                unique_lock lock(mutex_);
+                batch_ready_.wait(lock, [&] { return is_stopping_ || batch_number_ != done_batch_number; });
+                if (is_stopping_) {
+                    return;
+                }
+                done_batch_number = batch_number_;
+            }
+            ProcessRequests();
+            {
+                lock_guard lock(mutex_);
+                if (--busy_workers_ == 0) {
+                    batch_done_.notify_one();
                 }
-                stream << "\t\t\t\t\"time\": " << setprecision(16) << item.time << endl;
-                stream << "\t\t\t}";
-                items_counter++;
-                if (items_counter != response.items.size()) stream << ",";
-                stream << endl;
             }
-            stream << "\t\t]," << endl;
-            stream << "\t\t\"map\": " /*<< "\""*/ << response.svg/* << "\""*/ << endl;
         }
-        else if (response_holder->type == Request::Type::MAP) {
-            const auto& response = static_cast<const MapResponse&>(*response_holder);
-            stream << "\t\t\"map\": " /*<< "\""*/ << response.svg/* << "\""*/ << endl;
+    }
+
+    void RunBatch() {
+        if (requests_.empty()) {
+            return;
+        }
+        responses_.resize(requests_.size());
+        GroupRequests();
+        next_unit_ = 0;
+        manager_ = versions_.Acquire();
+        {
+            lock_guard lock(mutex_);
+            ++batch_number_;
+            busy_workers_ = workers_.size();
+        }
+        batch_ready_.notify_all();
+        ProcessRequests();
+        {
+            unique_lock lock(mutex_);
+            batch_done_.wait(lock, [&] { return busy_workers_ == 0; });
+        }
+        if (error_) {
+            rethrow_exception(exchange(error_, nullptr));
+        }
+        for (const auto& response : responses_) {
+            if (response) {
+                writer_.Write(*response);
+            }
         }
-        stream << "\t}";
-        response_counter++;
-        if (response_counter != responses.size())
-            stream << ",";
-        stream << endl;
+        requests_.clear();
+        responses_.clear();
+        manager_.reset();
+    }
+};
+
+void PrintValidation(const NetworkValidation& validation, const TransportManager& manager, ostream& stream = cerr) {
+    for (const auto& missing : validation.missing_distances) {
+        stream << "Warning: bus " << manager.GetBus(missing.bus)->GetName()
+            << " has no road distance between " << manager.GetStopName(missing.from)
+            << " and " << manager.GetStopName(missing.to) << ", counted as 0" << endl;
     }
-    stream << "]" << endl;
 }
 
-int main() {
-    ofstream out("C:\\Users\\User\\Desktop\\Coursera\\out.txt");
-    try {
-        auto document = Json::Load(cin);
-        const auto& settings = document.GetRoot().AsMap().at("routing_settings").AsMap();
-        TransportManager manager(settings.at("bus_wait_time").AsNumber(), settings.at("bus_velocity").AsNumber());
-        ProcessRequests(ReadRequests(ParseInputRequest, document.GetRoot().AsMap().at("base_requests")), manager);
+// Nothing when no route was looked up.
+void PrintRouteCacheStats(const TransportManager& manager, ostream& stream = cerr) {
+    const auto stats = manager.GetRouteCacheStats();
+    if (stats.hits + stats.misses == 0) {
+        return;
+    }
+    stream << "Route cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+        << stats.evictions << " evictions, " << stats.entries << " entries of "
+        << stats.bytes << " bytes" << endl;
+}
+
+// FULL builds the network and answers the stat requests in one run. There,
+// update_requests after the base requests and both settings hold Stop and Bus
+// requests that change the network: the stat requests read so far are
+// answered first, then a new version with the changes is published, and the
+// stat requests after it read that version.
+// MAKE_BASE builds it and saves a snapshot to serialization_settings.file,
+// and PROCESS_REQUESTS answers the stat requests from that snapshot, ignoring
+// the base requests and the settings. serialization_settings.verify makes
+// PROCESS_REQUESTS check the checksum of the whole snapshot before answering.
+enum class RunMode {
+    FULL,
+    MAKE_BASE,
+    PROCESS_REQUESTS,
+};
+
+// Feeds the document into the manager while it is being read: base requests
+// are applied element by element, and once the network and both settings are
+// known, the network is published to versions and stat requests are handed to
+// the executor as they arrive. Stat requests that come earlier in the
+// document are kept until the end, or until the next update_requests.
+void ProcessStream(Json::View::StreamReader& reader, TransportManagerVersions& versions, ostream& output, RunMode mode = RunMode::FULL) {
+    TransportManager manager;
+    bool has_routing_settings = false;
+    optional<Json::View::Object> render_settings;
+    bool has_base_requests = false;
+    optional<string> snapshot_path;
+    bool is_built = false;
+    vector<RequestHolder> pending_requests;
+    optional<ResponseWriter> writer;
+    optional<StatRequestExecutor> executor;
+    if (mode != RunMode::MAKE_BASE) {
+        writer.emplace(output);
+        executor.emplace(versions, *writer);
+    }
 
+    const auto build = [&] {
+        if (is_built) {
+            return;
+        }
+        if (mode == RunMode::PROCESS_REQUESTS) {
+            throw out_of_range("serialization_settings are required");
+        }
+        if (!has_routing_settings || !render_settings) {
+            throw out_of_range("routing_settings and render_settings are required");
+        }
+        PrintValidation(manager.Finalize(), manager);
         manager.BuildRouter();
-        manager.BuildMap(document.GetRoot().AsMap().at("render_settings").AsMap());
+        manager.BuildMap(*render_settings);
+        versions.Update([&](TransportManager& next) { next = manager; });
+        is_built = true;
+    };
+    const auto is_ready = [&] {
+        return mode == RunMode::PROCESS_REQUESTS
+            ? is_built
+            : has_base_requests && has_routing_settings && render_settings;
+    };
 
-        PrintResponses(ProcessRequests(ReadRequests(ParseOutputRequest, document.GetRoot().AsMap().at("stat_requests")), manager), cout);
+    reader.ReadRootObject([&](string_view key) {
+        if (key == "serialization_settings") {
+            const auto settings = reader.ReadValue().AsMap();
+            snapshot_path = string(settings.at("file").AsString());
+            if (mode == RunMode::PROCESS_REQUESTS) {
+                const auto verify = settings.find("verify");
+                manager.LoadSnapshot(*snapshot_path, verify != settings.end() && verify->second.AsBool());
+                versions.Update([&](TransportManager& next) { next = manager; });
+                is_built = true;
+            }
+        }
+        else if (mode == RunMode::PROCESS_REQUESTS && key != "stat_requests") {
+            reader.SkipValue();
+        }
+        else if (key == "routing_settings") {
+            const auto settings = reader.ReadValue().AsMap();
+            manager.SetRoutingSettings(settings.at("bus_wait_time").AsNumber(), settings.at("bus_velocity").AsNumber(), ReadRouterType(settings));
+            has_routing_settings = true;
+        }
+        else if (key == "render_settings") {
+            render_settings = reader.ReadValue().AsMap();
+        }
+        else if (key == "base_requests") {
+            reader.ReadArray([&](const Json::View::Node& node) {
+                if (auto request = ParseInputRequest(node)) {
+                    ApplyModifyRequest(*request, manager);
+                }
+            });
+            has_base_requests = true;
+        }
+        else if (key == "update_requests" && mode == RunMode::FULL) {
+            if (!is_ready()) {
+                throw out_of_range("update_requests must follow base_requests and both settings");
+            }
+            build();
+            vector<RequestHolder> updates;
+            reader.ReadArray([&](const Json::View::Node& node) {
+                if (auto request = ParseInputRequest(node)) {
+                    updates.push_back(move(request));
+                }
+            });
+            for (auto& request : pending_requests) {
+                executor->Submit(move(request));
+            }
+            pending_requests.clear();
+            executor->Flush();
+            versions.Update([&](TransportManager& next) {
+                for (const auto& request : updates) {
+                    ApplyModifyRequest(*request, next);
+                }
+                PrintValidation(next.Finalize(), next);
+                next.BuildRouter();
+                next.BuildMap(*render_settings);
+            });
+        }
+        else if (key == "stat_requests" && executor) {
+            reader.ReadArray([&](const Json::View::Node& node) {
+                auto request = ParseOutputRequest(node);
+                if (!request) {
+                    return;
+                }
+                if (is_ready()) {
+                    build();
+                    executor->Submit(move(request));
+                }
+                else {
+                    pending_requests.push_back(move(request));
+                }
+            });
+        }
+        else {
+            reader.SkipValue();
+        }
+    });
 
-        out.close();
+    build();
+    if (mode == RunMode::MAKE_BASE) {
+        if (!snapshot_path) {
+            throw out_of_range("serialization_settings are required");
+        }
+        manager.SaveSnapshot(*snapshot_path);
+        return;
+    }
+    for (auto& request : pending_requests) {
+        executor->Submit(move(request));
+    }
+    executor->Flush();
+    writer->Finish();
+    PrintRouteCacheStats(*versions.Acquire());
+}
+
+// Usage: main [make_base | process_requests] [input.json]
+int main(int argc, char* argv[]) {
+    try {
+        RunMode mode = RunMode::FULL;
+        int arg_idx = 1;
+        if (argc > arg_idx && string_view(argv[arg_idx]) == "make_base") {
+            mode = RunMode::MAKE_BASE;
+            ++arg_idx;
+        }
+        else if (argc > arg_idx && string_view(argv[arg_idx]) == "process_requests") {
+            mode = RunMode::PROCESS_REQUESTS;
+            ++arg_idx;
+        }
+        Json::View::StreamReader reader(argc > arg_idx ? Json::Detail::ReadFile(argv[arg_idx]) : Json::Detail::ReadStream(cin));
+        TransportManagerVersions versions{TransportManager()};
+        ProcessStream(reader, versions, cout, mode);
     }
     catch (exception& ex) {
         cerr << ex.what() << endl;
@@ -0,0 +1,257 @@
+#include "Manager.h"
+#include "test_runner.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+
+// Build: g++ -std=c++17 -pthread manager_test.cpp Manager.cpp Json.cpp JsonView.cpp input_buffer.cpp svg.cpp snapshot.cpp raptor.cpp
+
+const string RENDER_SETTINGS = R"({"width": 1200, "height": 800, "padding": 50, "stop_radius": 5, "line_width": 14,
+    "stop_label_font_size": 18, "stop_label_offset": [7, -3], "underlayer_color": [255, 255, 255, 0.85],
+    "underlayer_width": 3, "color_palette": ["green", [255, 160, 0], "red"], "bus_label_font_size": 20,
+    "bus_label_offset": [7, 15], "layers": ["bus_lines", "bus_labels", "stop_points", "stop_labels"],
+    "outer_margin": 150})";
+
+string GetStopName(size_t stop) {
+    return "Stop " + to_string(stop);
+}
+
+// Adds stops [first_stop, last_stop) and bus_count buses over stops
+// [0, last_stop). A road distance is given for every pair of neighbouring
+// stops of a bus that has none yet, so the distances of earlier buses stay.
+void AddNetwork(TransportManager& manager, mt19937& random, size_t first_stop, size_t last_stop,
+                size_t first_bus, size_t bus_count, set<pair<size_t, size_t>>& distances) {
+    for (size_t stop = first_stop; stop < last_stop; ++stop) {
+        manager.AddStop(GetStopName(stop), { 55.5 + (random() % 1000) / 1e4, 37.5 + (random() % 1000) / 1e4 });
+    }
+    for (size_t bus = first_bus; bus < first_bus + bus_count; ++bus) {
+        const size_t stop_count = 2 + random() % 5;
+        vector<size_t> route;
+        for (size_t i = 0; i < stop_count; ++i) {
+            route.push_back(random() % last_stop);
+        }
+        const bool is_roundtrip = random() % 2;
+        if (is_roundtrip) {
+            route.push_back(route.front());
+        }
+        vector<string> stops;
+        for (size_t i = 0; i < route.size(); ++i) {
+            stops.push_back(GetStopName(route[i]));
+            if (i > 0 && !distances.count({route[i - 1], route[i]}) && !distances.count({route[i], route[i - 1]})) {
+                distances.insert({route[i - 1], route[i]});
+                manager.AddDistance(GetStopName(route[i - 1]), GetStopName(route[i]), 100 + random() % 3000);
+            }
+        }
+        manager.AddBus("Bus " + to_string(bus), stops, !is_roundtrip);
+    }
+}
+
+double GetRouteTime(const vector<RouteItem>& items) {
+    double time = 0;
+    for (const auto& item : items) {
+        time += item.time;
+    }
+    return time;
+}
+
+// Builds a network, builds the router, grows the network and builds the
+// router again, which may extend the first one. A manager fed the whole
+// network at once must find routes of the same time between all stops.
+void CheckExtendedMatchesRebuilt(Graph::RouterType router_type) {
+    const auto render_settings = Json::View::Load(RENDER_SETTINGS);
+    for (size_t seed = 0; seed < 10; ++seed) {
+        const size_t base_stop_count = 10 + seed;
+        const size_t stop_count = base_stop_count + seed % 4;
+        const size_t base_bus_count = 4 + seed % 3;
+        const size_t bus_count = base_bus_count + 1 + seed % 3;
+
+        TransportManager extended;
+        extended.SetRoutingSettings(6, 40, router_type);
+        {
+            mt19937 random(seed);
+            set<pair<size_t, size_t>> distances;
+            AddNetwork(extended, random, 0, base_stop_count, 0, base_bus_count, distances);
+            extended.Finalize();
+            extended.BuildRouter();
+            // Nothing has changed, so the router is reused as it is.
+            extended.BuildRouter();
+            AddNetwork(extended, random, base_stop_count, stop_count, base_bus_count, bus_count - base_bus_count, distances);
+            extended.Finalize();
+            extended.BuildRouter();
+            extended.BuildMap(render_settings.GetRoot().AsMap());
+        }
+
+        TransportManager rebuilt;
+        rebuilt.SetRoutingSettings(6, 40, router_type);
+        {
+            mt19937 random(seed);
+            set<pair<size_t, size_t>> distances;
+            AddNetwork(rebuilt, random, 0, base_stop_count, 0, base_bus_count, distances);
+            AddNetwork(rebuilt, random, base_stop_count, stop_count, base_bus_count, bus_count - base_bus_count, distances);
+            rebuilt.Finalize();
+            rebuilt.BuildRouter();
+            rebuilt.BuildMap(render_settings.GetRoot().AsMap());
+        }
+
+        for (size_t from = 0; from < stop_count; ++from) {
+            for (size_t to = 0; to < stop_count; ++to) {
+                const auto extended_route = extended.GetRoute(GetStopName(from), GetStopName(to));
+                const auto rebuilt_route = rebuilt.GetRoute(GetStopName(from), GetStopName(to));
+                const string hint = "seed " + to_string(seed) + ", from " + to_string(from) + " to " + to_string(to);
+                AssertEqual(extended_route.first.empty(), rebuilt_route.first.empty(), hint);
+                Assert(abs(GetRouteTime(extended_route.second) - GetRouteTime(rebuilt_route.second)) < 1e-9, hint);
+            }
+        }
+    }
+}
+
+void TestAllPairsExtensionMatchesRebuild() {
+    CheckExtendedMatchesRebuilt(Graph::RouterType::ALL_PAIRS);
+}
+
+void TestContractionHierarchiesRebuild() {
+    CheckExtendedMatchesRebuilt(Graph::RouterType::CONTRACTION_HIERARCHIES);
+}
+
+shared_ptr<const RouteCache::Value> MakeCachedRoute(size_t overlay_size) {
+    return make_shared<const RouteCache::Value>(RouteCache::Value{string(overlay_size, 'x'), {}});
+}
+
+// Keys are spread over shards by a hash, so the test finds keys that share a
+// shard with (0, 0) through the cache itself: with room for one value per
+// shard, inserting a key of the same shard evicts (0, 0).
+vector<pair<StopId, StopId>> FindKeysOfOneShard(size_t value_bytes, size_t count) {
+    vector<pair<StopId, StopId>> keys = {{0, 0}};
+    for (StopId to = 1; keys.size() < count; ++to) {
+        RouteCache probe(16 * value_bytes);
+        probe.Insert(0, 0, MakeCachedRoute(100));
+        probe.Insert(0, to, MakeCachedRoute(100));
+        if (probe.GetStats().evictions == 1) {
+            keys.push_back({0, to});
+        }
+    }
+    return keys;
+}
+
+void TestRouteCache() {
+    size_t value_bytes = 0;
+    {
+        RouteCache cache(1 << 20);
+        cache.Insert(0, 0, MakeCachedRoute(100));
+        value_bytes = cache.GetStats().bytes;
+        Assert(value_bytes > 100, "the overlay is counted");
+    }
+    const auto keys = FindKeysOfOneShard(value_bytes, 4);
+
+    // Each shard holds three values.
+    RouteCache cache(16 * 3 * value_bytes);
+    for (size_t i = 0; i < 3; ++i) {
+        cache.Insert(keys[i].first, keys[i].second, MakeCachedRoute(100));
+    }
+    auto stats = cache.GetStats();
+    AssertEqual(stats.entries, 3u);
+    AssertEqual(stats.bytes, 3 * value_bytes);
+    AssertEqual(stats.evictions, 0u);
+
+    // keys[0] becomes the most recently used, so keys[1] is evicted.
+    Assert(cache.Find(keys[0].first, keys[0].second) != nullptr, "keys[0] is cached");
+    cache.Insert(keys[3].first, keys[3].second, MakeCachedRoute(100));
+    Assert(cache.Find(keys[1].first, keys[1].second) == nullptr, "keys[1] is evicted");
+    Assert(cache.Find(keys[0].first, keys[0].second) != nullptr, "keys[0] is kept");
+    Assert(cache.Find(keys[2].first, keys[2].second) != nullptr, "keys[2] is kept");
+    Assert(cache.Find(keys[3].first, keys[3].second) != nullptr, "keys[3] is cached");
+    stats = cache.GetStats();
+    AssertEqual(stats.hits, 4u);
+    AssertEqual(stats.misses, 1u);
+    AssertEqual(stats.evictions, 1u);
+    AssertEqual(stats.entries, 3u);
+    AssertEqual(stats.bytes, 3 * value_bytes);
+
+    // A value larger than a shard is not kept and evicts nothing.
+    cache.Insert(keys[1].first, keys[1].second, MakeCachedRoute(3 * value_bytes));
+    Assert(cache.Find(keys[1].first, keys[1].second) == nullptr, "a value larger than a shard is not kept");
+    stats = cache.GetStats();
+    AssertEqual(stats.evictions, 1u);
+    AssertEqual(stats.entries, 3u);
+    AssertEqual(stats.bytes, 3 * value_bytes);
+}
+
+// Readers query whatever version is current while a writer publishes new
+// ones with a bus more each. A reader must never see a version lose a bus,
+// and every version must answer the same route the same way twice.
+void TestVersionsReadersAndWriter() {
+    const auto render_settings = Json::View::Load(RENDER_SETTINGS);
+    const size_t stop_count = 12;
+    const size_t base_bus_count = 4;
+    const size_t update_count = 8;
+
+    mt19937 random(1);
+    set<pair<size_t, size_t>> distances;
+    TransportManager base;
+    base.SetRoutingSettings(6, 40, Graph::RouterType::ALL_PAIRS);
+    AddNetwork(base, random, 0, stop_count, 0, base_bus_count, distances);
+    base.Finalize();
+    base.BuildRouter();
+    base.BuildMap(render_settings.GetRoot().AsMap());
+    TransportManagerVersions versions(move(base));
+
+    atomic<bool> is_done = false;
+    vector<string> errors(3);
+    vector<thread> readers;
+    for (size_t reader = 0; reader < errors.size(); ++reader) {
+        readers.emplace_back([&, reader] {
+            size_t seen_bus_count = base_bus_count;
+            for (size_t step = 0; errors[reader].empty(); ++step) {
+                const bool was_done = is_done;
+                const auto version = versions.Acquire();
+                size_t bus_count = 0;
+                while (version->FindBus("Bus " + to_string(bus_count))) {
+                    ++bus_count;
+                }
+                if (bus_count < seen_bus_count) {
+                    errors[reader] = "bus count went from " + to_string(seen_bus_count) + " to " + to_string(bus_count);
+                }
+                seen_bus_count = bus_count;
+                const string from = GetStopName(step % stop_count);
+                const string to = GetStopName(step * 7 % stop_count);
+                const auto first = version->GetRoute(from, to);
+                const auto second = version->GetRoute(from, to);
+                if (first.first != second.first || GetRouteTime(first.second) != GetRouteTime(second.second)) {
+                    errors[reader] = "route from " + from + " to " + to + " changed within a version";
+                }
+                if (was_done) {
+                    if (bus_count != base_bus_count + update_count) {
+                        errors[reader] = "the last version has " + to_string(bus_count) + " buses";
+                    }
+                    break;
+                }
+            }
+        });
+    }
+    for (size_t update = 0; update < update_count; ++update) {
+        const auto published = versions.Update([&](TransportManager& next) {
+            AddNetwork(next, random, stop_count, stop_count, base_bus_count + update, 1, distances);
+            next.Finalize();
+            next.BuildRouter();
+            next.BuildMap(render_settings.GetRoot().AsMap());
+        });
+        AssertEqual(published.get(), versions.Acquire().get());
+    }
+    is_done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    for (const auto& error : errors) {
+        AssertEqual(error, "");
+    }
+}
+
+int main() {
+    TestRunner tr;
+    RUN_TEST(tr, TestAllPairsExtensionMatchesRebuild);
+    RUN_TEST(tr, TestContractionHierarchiesRebuild);
+    RUN_TEST(tr, TestVersionsReadersAndWriter);
+    RUN_TEST(tr, TestRouteCache);
+    return 0;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "graph.h"
+#include "router.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace Graph {
+
+    // Routes that minimise two criteria at once: the edge weight and a small
+    // count carried by every edge, such as the boardings of a trip. A query
+    // returns the Pareto set, every route that no other route beats on both.
+    // Labels are settled in order of (weight, count), so a label is kept only
+    // when its count is below the counts of every label already settled at its
+    // vertex and at the target; each vertex thus keeps at most one label per
+    // count. Labels and the heap live in pooled workspaces, so queries may run
+    // concurrently and reuse their memory.
+    template <typename Weight>
+    class ParetoRouter {
+    private:
+        using Graph = CompactGraph<Weight>;
+
+    public:
+        struct Route {
+            Weight weight;
+            uint32_t count;
+            std::vector<EdgeId> edges;
+        };
+
+        // edge_counts holds the count of every edge of graph, by EdgeId.
+        ParetoRouter(const Graph& graph, std::vector<uint8_t> edge_counts);
+
+        // Sorted by weight, so counts decrease; empty when to is unreachable.
+        std::vector<Route> FindRoutes(VertexId from, VertexId to) const;
+
+    private:
+        static constexpr uint32_t NO_LABEL = UINT32_MAX;
+
+        const Graph& graph_;
+        std::vector<uint8_t> edge_counts_;
+
+        struct Label {
+            VertexId vertex;
+            Weight weight;
+            uint32_t count;
+            uint32_t prev_label;
+            EdgeId prev_edge;
+        };
+
+        struct QueueItem {
+            Weight weight;
+            uint32_t count;
+            uint32_t label;
+
+            bool operator>(const QueueItem& other) const {
+                return std::tie(weight, count) > std::tie(other.weight, other.count);
+            }
+        };
+
+        struct Workspace {
+            std::vector<Label> labels;
+            // Min-heap of labels still to settle.
+            std::vector<QueueItem> queue;
+            // Lowest count settled at every vertex carrying the stamp.
+            std::vector<uint32_t> min_counts;
+            std::vector<uint32_t> stamps;
+            uint32_t current_stamp = 0;
+
+            explicit Workspace(size_t vertex_count) : min_counts(vertex_count), stamps(vertex_count, 0) {}
+
+            void Reset() {
+                labels.clear();
+                queue.clear();
+                if (++current_stamp == 0) {
+                    std::fill(stamps.begin(), stamps.end(), 0);
+                    current_stamp = 1;
+                }
+            }
+
+            uint32_t GetMinCount(VertexId vertex) const {
+                return stamps[vertex] == current_stamp ? min_counts[vertex] : UINT32_MAX;
+            }
+        };
+
+        WorkspacePool<Workspace> workspaces_;
+
+        void Push(Workspace& workspace, const Label& label) const;
+        void CollectEdges(const Workspace& workspace, uint32_t label_id, std::vector<EdgeId>& edges) const;
+    };
+
+
+    template <typename Weight>
+    ParetoRouter<Weight>::ParetoRouter(const Graph& graph, std::vector<uint8_t> edge_counts)
+        : graph_(graph),
+        edge_counts_(std::move(edge_counts)),
+        workspaces_(graph.GetVertexCount())
+    {
+        assert(edge_counts_.size() == graph_.GetEdgeCount());
+    }
+
+    template <typename Weight>
+    void ParetoRouter<Weight>::Push(Workspace& workspace, const Label& label) const {
+        workspace.queue.push_back({label.weight, label.count, static_cast<uint32_t>(workspace.labels.size())});
+        std::push_heap(workspace.queue.begin(), workspace.queue.end(), std::greater<QueueItem>());
+        workspace.labels.push_back(label);
+    }
+
+    template <typename Weight>
+    void ParetoRouter<Weight>::CollectEdges(const Workspace& workspace, uint32_t label_id, std::vector<EdgeId>& edges) const {
+        edges.clear();
+        for (; workspace.labels[label_id].prev_label != NO_LABEL; label_id = workspace.labels[label_id].prev_label) {
+            edges.push_back(workspace.labels[label_id].prev_edge);
+        }
+        std::reverse(std::begin(edges), std::end(edges));
+    }
+
+    template <typename Weight>
+    std::vector<typename ParetoRouter<Weight>::Route> ParetoRouter<Weight>::FindRoutes(VertexId from, VertexId to) const {
+        const auto workspace = workspaces_.Acquire();
+        workspace->Reset();
+        auto& queue = workspace->queue;
+        std::vector<uint32_t> target_labels;
+        Push(*workspace, {from, 0, 0, NO_LABEL, 0});
+
+        while (!queue.empty()) {
+            std::pop_heap(queue.begin(), queue.end(), std::greater<QueueItem>());
+            const QueueItem item = queue.back();
+            queue.pop_back();
+            // Anything settled before weighs no more, so a count as high
+            // as one settled here or at the target is dominated.
+            if (item.count >= std::min(workspace->GetMinCount(workspace->labels[item.label].vertex), workspace->GetMinCount(to))) {
+                continue;
+            }
+            const VertexId vertex = workspace->labels[item.label].vertex;
+            workspace->min_counts[vertex] = item.count;
+            workspace->stamps[vertex] = workspace->current_stamp;
+            if (vertex == to) {
+                target_labels.push_back(item.label);
+                continue;
+            }
+            for (const EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+                const VertexId edge_to = graph_.GetEdgeTo(edge_id);
+                const uint32_t count = item.count + edge_counts_[edge_id];
+                if (count >= std::min(workspace->GetMinCount(edge_to), workspace->GetMinCount(to))) {
+                    continue;
+                }
+                assert(graph_.GetEdgeWeight(edge_id) >= 0);
+                Push(*workspace, {edge_to, item.weight + graph_.GetEdgeWeight(edge_id), count, item.label, edge_id});
+            }
+        }
+
+        std::vector<Route> routes;
+        routes.reserve(target_labels.size());
+        for (const uint32_t label_id : target_labels) {
+            const Label& label = workspace->labels[label_id];
+            Route route{label.weight, label.count, {}};
+            CollectEdges(*workspace, label_id, route.edges);
+            routes.push_back(std::move(route));
+        }
+        return routes;
+    }
+
+}
@@ -0,0 +1,226 @@
+#include "raptor.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+namespace Raptor {
+
+    void TimetableRouter::Workspace::Reset() {
+        if (++current_stamp == 0) {
+            for (auto& label : labels) {
+                label.stamp = 0;
+            }
+            fill(best_stamps.begin(), best_stamps.end(), 0);
+            current_stamp = 1;
+        }
+    }
+
+    TimetableRouter::TimetableRouter(size_t stop_count, const vector<BusTimetable>& buses)
+        : stop_count_(stop_count),
+        workspaces_(stop_count)
+    {
+        for (const auto& bus : buses) {
+            vector<const vector<double>*> trips;
+            trips.reserve(bus.trips.size());
+            for (const auto& trip : bus.trips) {
+                trips.push_back(&trip);
+            }
+            sort(trips.begin(), trips.end(), [](const vector<double>* lhs, const vector<double>* rhs) {
+                return *lhs < *rhs;
+            });
+            // A trip joins the first route whose last trip it never overtakes,
+            // so the trips of every route are ordered at each of its stops.
+            vector<vector<const vector<double>*>> route_trips;
+            for (const auto* trip : trips) {
+                const auto it = find_if(route_trips.begin(), route_trips.end(), [trip](const auto& other_trips) {
+                    const auto& last = *other_trips.back();
+                    for (size_t position = 0; position < last.size(); ++position) {
+                        if ((*trip)[position] < last[position]) {
+                            return false;
+                        }
+                    }
+                    return true;
+                });
+                if (it == route_trips.end()) {
+                    route_trips.push_back({ trip });
+                }
+                else {
+                    it->push_back(trip);
+                }
+            }
+            for (const auto& route : route_trips) {
+                AddRoute(bus.bus, bus.stops, route);
+            }
+        }
+
+        stop_visit_offsets_.assign(stop_count_ + 1, 0);
+        for (const StopId stop : route_stops_) {
+            ++stop_visit_offsets_[stop + 1];
+        }
+        for (size_t stop = 0; stop < stop_count_; ++stop) {
+            stop_visit_offsets_[stop + 1] += stop_visit_offsets_[stop];
+        }
+        stop_visits_.resize(route_stops_.size());
+        vector<uint32_t> next_visit(stop_visit_offsets_.begin(), stop_visit_offsets_.end() - 1);
+        for (uint32_t route_id = 0; route_id < routes_.size(); ++route_id) {
+            const Route& route = routes_[route_id];
+            for (uint32_t position = 0; position < route.stop_count; ++position) {
+                const StopId stop = route_stops_[route.stops_begin + position];
+                stop_visits_[next_visit[stop]++] = { route_id, position };
+            }
+        }
+    }
+
+    void TimetableRouter::AddRoute(BusId bus, const vector<StopId>& stops, const vector<const vector<double>*>& trips) {
+        routes_.push_back({
+            bus,
+            static_cast<uint32_t>(trips.size()),
+            static_cast<uint32_t>(route_stops_.size()),
+            static_cast<uint32_t>(stops.size()),
+            stop_times_.size(),
+        });
+        route_stops_.insert(route_stops_.end(), stops.begin(), stops.end());
+        for (const auto* trip : trips) {
+            stop_times_.insert(stop_times_.end(), trip->begin(), trip->end());
+        }
+    }
+
+    uint32_t TimetableRouter::FindEarliestTrip(const Route& route, uint32_t position, double time) const {
+        uint32_t low = 0;
+        uint32_t high = route.trip_count;
+        while (low < high) {
+            const uint32_t middle = low + (high - low) / 2;
+            if (GetTime(route, middle, position) < time) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        return low < route.trip_count ? low : NONE;
+    }
+
+    const TimetableRouter::Label* TimetableRouter::FindPreviousLabel(const Workspace& workspace, size_t round, StopId stop) const {
+        if (workspace.best_stamps[stop] != workspace.current_stamp) {
+            return nullptr;
+        }
+        while (round-- > 0) {
+            const Label& label = workspace.labels[round * stop_count_ + stop];
+            if (label.stamp == workspace.current_stamp) {
+                return &label;
+            }
+        }
+        return nullptr;
+    }
+
+    void TimetableRouter::ScanRoute(Workspace& workspace, uint32_t route_id, size_t round, StopId target) const {
+        const Route& route = routes_[route_id];
+        const StopId* stops = &route_stops_[route.stops_begin];
+        const uint32_t current_stamp = workspace.current_stamp;
+        const auto get_best = [&](StopId stop) {
+            return workspace.best_stamps[stop] == current_stamp ? workspace.best_arrivals[stop] : numeric_limits<double>::infinity();
+        };
+
+        uint32_t trip = NONE;
+        uint32_t board_position = 0;
+        for (uint32_t position = workspace.route_starts[route_id]; position < route.stop_count; ++position) {
+            const StopId stop = stops[position];
+            if (trip != NONE) {
+                const double arrival = GetTime(route, trip, position);
+                // Arrivals after the best one at the target cannot lead to a better journey.
+                if (arrival < get_best(stop) && arrival < get_best(target)) {
+                    workspace.labels[round * stop_count_ + stop] = { arrival, route_id, trip, board_position, position, current_stamp };
+                    workspace.best_arrivals[stop] = arrival;
+                    workspace.best_stamps[stop] = current_stamp;
+                    if (!workspace.is_marked[stop]) {
+                        workspace.is_marked[stop] = 1;
+                        workspace.marked_stops.push_back(stop);
+                    }
+                }
+            }
+            const Label* previous = FindPreviousLabel(workspace, round, stop);
+            if (previous && (trip == NONE || previous->arrival <= GetTime(route, trip, position))) {
+                const uint32_t earlier_trip = FindEarliestTrip(route, position, previous->arrival);
+                if (earlier_trip != NONE && (trip == NONE || earlier_trip < trip)) {
+                    trip = earlier_trip;
+                    board_position = position;
+                }
+            }
+        }
+    }
+
+    optional<Journey> TimetableRouter::FindJourney(StopId from, StopId to, double departure) const {
+        if (from >= stop_count_ || to >= stop_count_) {
+            return nullopt;
+        }
+        const auto workspace = workspaces_.Acquire();
+        workspace->Reset();
+        if (workspace->route_starts.size() != routes_.size()) {
+            workspace->route_starts.assign(routes_.size(), NONE);
+        }
+        const uint32_t current_stamp = workspace->current_stamp;
+        auto& labels = workspace->labels;
+        labels[from] = { departure, NONE, NONE, NONE, NONE, current_stamp };
+        workspace->best_arrivals[from] = departure;
+        workspace->best_stamps[from] = current_stamp;
+        auto& marked_stops = workspace->marked_stops;
+        marked_stops.assign(1, from);
+        workspace->is_marked[from] = 1;
+
+        for (size_t round = 1; round <= MAX_TRIPS && !marked_stops.empty(); ++round) {
+            auto& queued_routes = workspace->queued_routes;
+            for (const StopId stop : marked_stops) {
+                workspace->is_marked[stop] = 0;
+                for (uint32_t visit = stop_visit_offsets_[stop]; visit < stop_visit_offsets_[stop + 1]; ++visit) {
+                    const auto [route_id, position] = stop_visits_[visit];
+                    uint32_t& route_start = workspace->route_starts[route_id];
+                    if (route_start == NONE) {
+                        queued_routes.push_back(route_id);
+                        route_start = position;
+                    }
+                    else {
+                        route_start = min(route_start, position);
+                    }
+                }
+            }
+            marked_stops.clear();
+            for (const uint32_t route_id : queued_routes) {
+                ScanRoute(*workspace, route_id, round, to);
+                workspace->route_starts[route_id] = NONE;
+            }
+            queued_routes.clear();
+        }
+        for (const StopId stop : marked_stops) {
+            workspace->is_marked[stop] = 0;
+        }
+        marked_stops.clear();
+
+        if (workspace->best_stamps[to] != current_stamp) {
+            return nullopt;
+        }
+        Journey journey{ departure, workspace->best_arrivals[to], {} };
+        // Every later round improves on the earlier ones, so the latest label
+        // at a stop is its best one and needs the fewest trips for it.
+        size_t round = MAX_TRIPS + 1;
+        StopId stop = to;
+        while (labels[--round * stop_count_ + stop].stamp != current_stamp) {}
+        while (round > 0) {
+            const Label& label = labels[round * stop_count_ + stop];
+            const Route& route = routes_[label.route];
+            journey.legs.push_back({
+                route.bus,
+                label.board_position,
+                label.alight_position,
+                GetTime(route, label.trip, label.board_position),
+                label.arrival,
+            });
+            stop = route_stops_[route.stops_begin + label.board_position];
+            while (labels[--round * stop_count_ + stop].stamp != current_stamp) {}
+        }
+        reverse(journey.legs.begin(), journey.legs.end());
+        return journey;
+    }
+
+}
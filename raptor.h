@@ -0,0 +1,128 @@
+#pragma once
+
+#include "router.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Earliest-arrival routing over real departure times with RAPTOR: round k
+// scans, once each, the routes that serve a stop improved in round k - 1,
+// and so finds the best arrivals with k trips. Trips of one bus that never
+// overtake each other form a route; its stops and its stop times, trip by
+// trip, are stored in flat arrays, so a scan runs through contiguous memory.
+// There are no footpaths: a transfer happens at one stop.
+namespace Raptor {
+
+    using StopId = uint32_t;
+    using BusId = uint32_t;
+
+    // Stop times of a bus in minutes, one row per trip, one column per
+    // position of the bus route. Times never decrease along a trip.
+    struct BusTimetable {
+        BusId bus;
+        std::vector<StopId> stops;
+        std::vector<std::vector<double>> trips;
+    };
+
+    struct Leg {
+        BusId bus;
+        // Positions of the bus route where the leg boards and alights.
+        uint32_t board_position;
+        uint32_t alight_position;
+        double departure;
+        double arrival;
+    };
+
+    struct Journey {
+        double departure;
+        double arrival;
+        std::vector<Leg> legs;
+    };
+
+    class TimetableRouter {
+    public:
+        static constexpr size_t MAX_TRIPS = 8;
+
+        TimetableRouter(size_t stop_count, const std::vector<BusTimetable>& buses);
+
+        // The journey that leaves from no earlier than departure and reaches
+        // to first, with the fewest trips among equal arrivals; nullopt when
+        // to cannot be reached with at most MAX_TRIPS trips. May be called
+        // concurrently.
+        std::optional<Journey> FindJourney(StopId from, StopId to, double departure) const;
+
+        size_t GetStopEventCount() const { return stop_times_.size(); }
+
+    private:
+        static constexpr uint32_t NONE = UINT32_MAX;
+
+        struct Route {
+            BusId bus;
+            uint32_t trip_count;
+            // Into route_stops_ and stop_times_.
+            uint32_t stops_begin;
+            uint32_t stop_count;
+            uint64_t times_begin;
+        };
+
+        struct RouteVisit {
+            uint32_t route;
+            uint32_t position;
+        };
+
+        struct Label {
+            double arrival;
+            uint32_t route;
+            uint32_t trip;
+            uint32_t board_position;
+            uint32_t alight_position;
+            uint32_t stamp = 0;
+        };
+
+        struct Workspace {
+            // Round-major: labels[round * stop_count + stop]; round 0 holds
+            // the origin.
+            std::vector<Label> labels;
+            std::vector<double> best_arrivals;
+            std::vector<uint32_t> best_stamps;
+            std::vector<StopId> marked_stops;
+            std::vector<uint8_t> is_marked;
+            // First marked position of every route queued for the round.
+            std::vector<uint32_t> route_starts;
+            std::vector<uint32_t> queued_routes;
+            uint32_t current_stamp = 0;
+
+            explicit Workspace(size_t stop_count)
+                : labels((MAX_TRIPS + 1) * stop_count),
+                best_arrivals(stop_count),
+                best_stamps(stop_count, 0),
+                is_marked(stop_count, 0) {}
+
+            void Reset();
+        };
+
+        size_t stop_count_;
+        std::vector<Route> routes_;
+        std::vector<StopId> route_stops_;
+        std::vector<double> stop_times_;
+        // Routes through every stop, with the positions of the stop on them.
+        std::vector<uint32_t> stop_visit_offsets_;
+        std::vector<RouteVisit> stop_visits_;
+
+        Graph::WorkspacePool<Workspace> workspaces_;
+
+        double GetTime(const Route& route, uint32_t trip, uint32_t position) const {
+            return stop_times_[route.times_begin + static_cast<uint64_t>(trip) * route.stop_count + position];
+        }
+
+        // First trip that leaves position at time or later, or NONE.
+        uint32_t FindEarliestTrip(const Route& route, uint32_t position, double time) const;
+
+        void AddRoute(BusId bus, const std::vector<StopId>& stops, const std::vector<const std::vector<double>*>& trips);
+        void ScanRoute(Workspace& workspace, uint32_t route_id, size_t round, StopId target) const;
+        // The best arrival at stop with fewer than round trips, if any.
+        const Label* FindPreviousLabel(const Workspace& workspace, size_t round, StopId stop) const;
+    };
+
+}
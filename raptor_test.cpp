@@ -0,0 +1,153 @@
+#include "raptor.h"
+#include "test_runner.h"
+
+#include <queue>
+#include <random>
+#include <tuple>
+
+// Build: g++ -std=c++17 -pthread raptor_test.cpp raptor.cpp snapshot.cpp input_buffer.cpp
+
+using namespace Raptor;
+
+// Whole minutes, so that many arrivals tie. Trips of a bus may overtake each
+// other.
+vector<BusTimetable> MakeRandomTimetables(mt19937& random, size_t stop_count, size_t bus_count) {
+    vector<BusTimetable> buses;
+    for (BusId bus = 0; bus < bus_count; ++bus) {
+        BusTimetable timetable{bus, {}, {}};
+        const size_t route_size = 2 + random() % 6;
+        for (size_t position = 0; position < route_size; ++position) {
+            timetable.stops.push_back(random() % stop_count);
+        }
+        const size_t trip_count = 1 + random() % 4;
+        for (size_t trip = 0; trip < trip_count; ++trip) {
+            vector<double> times;
+            double time = random() % 60;
+            for (size_t position = 0; position < route_size; ++position) {
+                times.push_back(time);
+                time += random() % 10;
+            }
+            timetable.trips.push_back(move(times));
+        }
+        buses.push_back(move(timetable));
+    }
+    return buses;
+}
+
+// Earliest arrivals at to with at most k trips, k = 0..MAX_TRIPS, by a
+// time-dependent Dijkstra over (stop, trips taken) states.
+vector<optional<double>> FindEarliestArrivals(const vector<BusTimetable>& buses, size_t stop_count,
+                                              StopId from, StopId to, double departure) {
+    const size_t max_trips = TimetableRouter::MAX_TRIPS;
+    vector<vector<optional<double>>> arrivals(max_trips + 1, vector<optional<double>>(stop_count));
+    using QueueItem = tuple<double, StopId, size_t>;
+    priority_queue<QueueItem, vector<QueueItem>, greater<QueueItem>> queue;
+    arrivals[0][from] = departure;
+    queue.push({departure, from, 0});
+    while (!queue.empty()) {
+        const auto [time, stop, trips] = queue.top();
+        queue.pop();
+        if (time > *arrivals[trips][stop] || trips == max_trips) {
+            continue;
+        }
+        for (const auto& bus : buses) {
+            for (size_t board = 0; board < bus.stops.size(); ++board) {
+                if (bus.stops[board] != stop) {
+                    continue;
+                }
+                for (const auto& trip : bus.trips) {
+                    if (trip[board] < time) {
+                        continue;
+                    }
+                    for (size_t alight = board + 1; alight < bus.stops.size(); ++alight) {
+                        auto& arrival = arrivals[trips + 1][bus.stops[alight]];
+                        if (!arrival || trip[alight] < *arrival) {
+                            arrival = trip[alight];
+                            queue.push({trip[alight], bus.stops[alight], trips + 1});
+                        }
+                    }
+                }
+            }
+        }
+    }
+    vector<optional<double>> result(max_trips + 1);
+    for (size_t trips = 0; trips <= max_trips; ++trips) {
+        result[trips] = arrivals[trips][to];
+        if (trips > 0 && result[trips - 1] && (!result[trips] || *result[trips - 1] < *result[trips])) {
+            result[trips] = result[trips - 1];
+        }
+    }
+    return result;
+}
+
+// Every leg rides one trip of its bus, boards where the previous leg ended
+// and no earlier than it arrived.
+void CheckJourney(const vector<BusTimetable>& buses, StopId from, StopId to, double departure, const Journey& journey) {
+    StopId stop = from;
+    double time = departure;
+    for (const auto& leg : journey.legs) {
+        const auto& bus = buses[leg.bus];
+        ASSERT(leg.board_position < leg.alight_position);
+        ASSERT(leg.alight_position < bus.stops.size());
+        ASSERT_EQUAL(bus.stops[leg.board_position], stop);
+        ASSERT(leg.departure >= time);
+        bool is_trip = false;
+        for (const auto& trip : bus.trips) {
+            is_trip = is_trip || (trip[leg.board_position] == leg.departure && trip[leg.alight_position] == leg.arrival);
+        }
+        ASSERT(is_trip);
+        stop = bus.stops[leg.alight_position];
+        time = leg.arrival;
+    }
+    ASSERT_EQUAL(stop, to);
+    ASSERT_EQUAL(journey.departure, departure);
+    ASSERT_EQUAL(journey.arrival, time);
+}
+
+void TestEarliestArrivalMatchesDijkstra() {
+    mt19937 random(5);
+    for (int iteration = 0; iteration < 200; ++iteration) {
+        const size_t stop_count = 2 + random() % 15;
+        const auto buses = MakeRandomTimetables(random, stop_count, 1 + random() % 10);
+        const TimetableRouter router(stop_count, buses);
+        for (StopId from = 0; from < stop_count; ++from) {
+            for (StopId to = 0; to < stop_count; ++to) {
+                const double departure = random() % 60;
+                const auto expected = FindEarliestArrivals(buses, stop_count, from, to, departure);
+                const auto journey = router.FindJourney(from, to, departure);
+                ASSERT_EQUAL(journey.has_value(), expected.back().has_value());
+                if (!journey) {
+                    continue;
+                }
+                CheckJourney(buses, from, to, departure, *journey);
+                ASSERT_EQUAL(journey->arrival, *expected.back());
+                // The fewest trips among equal arrivals.
+                ASSERT(expected[journey->legs.size()] == expected.back());
+                ASSERT(journey->legs.empty() || expected[journey->legs.size() - 1] != expected.back());
+            }
+        }
+    }
+}
+
+// One bus per hop of a line, so a ride of n hops takes n trips.
+void TestTripLimit() {
+    const size_t stop_count = TimetableRouter::MAX_TRIPS + 2;
+    vector<BusTimetable> buses;
+    for (StopId stop = 0; stop + 1 < stop_count; ++stop) {
+        buses.push_back({stop, {stop, stop + 1}, {{10.0 * stop, 10.0 * stop + 5}}});
+    }
+    const TimetableRouter router(stop_count, buses);
+    const auto journey = router.FindJourney(0, stop_count - 2, 0);
+    ASSERT(journey.has_value());
+    ASSERT_EQUAL(journey->legs.size(), TimetableRouter::MAX_TRIPS);
+    ASSERT_EQUAL(journey->arrival, 10.0 * (stop_count - 3) + 5);
+    ASSERT(!router.FindJourney(0, stop_count - 1, 0));
+    ASSERT(router.FindJourney(1, stop_count - 1, 0).has_value());
+}
+
+int main() {
+    TestRunner tr;
+    RUN_TEST(tr, TestEarliestArrivalMatchesDijkstra);
+    RUN_TEST(tr, TestTripLimit);
+    return 0;
+}
@@ -1,27 +1,38 @@
 #pragma once
 
 #include "graph.h"
-#include "Manager.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstdint>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <stdexcept>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace Graph {
 
-    template <typename Weight>
-    class Router {
-    private:
-        using Graph = DirectedWeightedGraph<Weight>;
+    enum class RouterType {
+        ALL_PAIRS,
+        DIJKSTRA,
+        CONTRACTION_HIERARCHIES,
+    };
 
+    // Common interface of the routing engines. FindRoute returns the edges of
+    // a route and keeps nothing; the id-based BuildRoute keeps them in the
+    // router until ReleaseRoute, and is left for older callers. All const
+    // methods may be called concurrently.
+    template <typename Weight>
+    class RouterBase {
     public:
-        Router(const Graph& graph);
-
         using RouteId = uint64_t;
 
         struct RouteInfo {
@@ -30,110 +41,545 @@ namespace Graph {
             size_t edge_count;
         };
 
+        struct Route {
+            Weight weight;
+            std::vector<EdgeId> edges;
+        };
+
+        virtual ~RouterBase() = default;
+
+        // Replaces the contents of edges with the route from -> to and returns
+        // its weight, or nullopt when there is no route. A buffer reused across
+        // queries stops allocating once it fits the longest route.
+        virtual std::optional<Weight> FindRouteEdges(VertexId from, VertexId to, std::vector<EdgeId>& edges) const = 0;
+        // Writes the preprocessing results, which the snapshot constructor of
+        // the same router type reads back instead of recomputing them.
+        virtual void Save(Snapshot::Writer& writer) const = 0;
+
+        std::optional<Route> FindRoute(VertexId from, VertexId to) const;
+
+        // Routes from one vertex to each of targets, in order, with edges only
+        // when with_edges is set. By default every target is a query of its
+        // own; search-based routers answer all of them from one search.
+        virtual std::vector<std::optional<Route>> FindRoutes(VertexId from, const std::vector<VertexId>& targets,
+                                                             bool with_edges) const;
+
+        // Every vertex with a route from from that weighs at most max_weight,
+        // with the weight of that route, in no particular order.
+        virtual std::vector<std::pair<VertexId, Weight>> FindReachable(VertexId from, Weight max_weight) const = 0;
+
         std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const;
         EdgeId GetRouteEdge(RouteId route_id, size_t edge_idx) const;
         void ReleaseRoute(RouteId route_id);
 
     private:
-        const Graph& graph_;
-
-        struct RouteInternalData {
-            Weight weight;
-            std::optional<EdgeId> prev_edge;
-        };
-        using RoutesInternalData = std::vector<std::vector<std::optional<RouteInternalData>>>;
-
         using ExpandedRoute = std::vector<EdgeId>;
+
+        mutable std::mutex routes_mutex_;
         mutable RouteId next_route_id_ = 0;
         mutable std::unordered_map<RouteId, ExpandedRoute> expanded_routes_cache_;
+    };
 
-        void InitializeRoutesInternalData(const Graph& graph) {
-            const size_t vertex_count = graph.GetVertexCount();
-            for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
-            routes_internal_data_[vertex][vertex] = RouteInternalData{0, std::nullopt};
-            for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
-                const auto& edge = graph.GetEdge(edge_id);
-                assert(edge.weight >= 0);
-                auto& route_internal_data = routes_internal_data_[vertex][edge.to];
-                if (!route_internal_data || route_internal_data->weight > edge.weight) {
-                route_internal_data = RouteInternalData{edge.weight, edge_id};
-                }
+    template <typename Weight>
+    std::optional<typename RouterBase<Weight>::Route> RouterBase<Weight>::FindRoute(VertexId from, VertexId to) const {
+        std::vector<EdgeId> edges;
+        const auto weight = FindRouteEdges(from, to, edges);
+        if (!weight) {
+            return std::nullopt;
+        }
+        return Route{*weight, std::move(edges)};
+    }
+
+    template <typename Weight>
+    std::vector<std::optional<typename RouterBase<Weight>::Route>> RouterBase<Weight>::FindRoutes(
+            VertexId from, const std::vector<VertexId>& targets, bool with_edges) const {
+        std::vector<std::optional<Route>> routes;
+        routes.reserve(targets.size());
+        std::vector<EdgeId> edges;
+        for (const VertexId to : targets) {
+            if (const auto weight = FindRouteEdges(from, to, edges)) {
+                routes.push_back(Route{*weight, with_edges ? edges : std::vector<EdgeId>()});
+            } else {
+                routes.push_back(std::nullopt);
             }
+        }
+        return routes;
+    }
+
+    template <typename Weight>
+    std::optional<typename RouterBase<Weight>::RouteInfo> RouterBase<Weight>::BuildRoute(VertexId from, VertexId to) const {
+        ExpandedRoute edges;
+        const auto weight = FindRouteEdges(from, to, edges);
+        if (!weight) {
+            return std::nullopt;
+        }
+        const size_t route_edge_count = edges.size();
+        std::lock_guard lock(routes_mutex_);
+        const RouteId route_id = next_route_id_++;
+        expanded_routes_cache_[route_id] = std::move(edges);
+        return RouteInfo{route_id, *weight, route_edge_count};
+    }
+
+    template <typename Weight>
+    EdgeId RouterBase<Weight>::GetRouteEdge(RouteId route_id, size_t edge_idx) const {
+        std::lock_guard lock(routes_mutex_);
+        return expanded_routes_cache_.at(route_id)[edge_idx];
+    }
+
+    template <typename Weight>
+    void RouterBase<Weight>::ReleaseRoute(RouteId route_id) {
+        std::lock_guard lock(routes_mutex_);
+        expanded_routes_cache_.erase(route_id);
+    }
+
+    // Per-query scratch state of the search-based routers. Every query leases a
+    // workspace of its own, so concurrent queries never share labels, and
+    // returned workspaces are reused instead of being reallocated.
+    template <typename Workspace>
+    class WorkspacePool {
+    public:
+        class Lease {
+        public:
+            Lease(const WorkspacePool& pool, std::unique_ptr<Workspace> workspace)
+                : pool_(pool), workspace_(std::move(workspace)) {}
+            Lease(const Lease&) = delete;
+            Lease& operator=(const Lease&) = delete;
+            ~Lease() { pool_.Release(std::move(workspace_)); }
+
+            Workspace& operator*() const { return *workspace_; }
+            Workspace* operator->() const { return workspace_.get(); }
+
+        private:
+            const WorkspacePool& pool_;
+            std::unique_ptr<Workspace> workspace_;
+        };
+
+        // Workspaces are constructed from the vertex count of the graph.
+        explicit WorkspacePool(size_t vertex_count) : vertex_count_(vertex_count) {}
+
+        Lease Acquire() const;
+
+    private:
+        const size_t vertex_count_;
+        mutable std::mutex mutex_;
+        mutable std::vector<std::unique_ptr<Workspace>> free_workspaces_;
+
+        void Release(std::unique_ptr<Workspace> workspace) const;
+    };
+
+    template <typename Workspace>
+    typename WorkspacePool<Workspace>::Lease WorkspacePool<Workspace>::Acquire() const {
+        {
+            std::lock_guard lock(mutex_);
+            if (!free_workspaces_.empty()) {
+                auto workspace = std::move(free_workspaces_.back());
+                free_workspaces_.pop_back();
+                return Lease(*this, std::move(workspace));
             }
         }
+        return Lease(*this, std::make_unique<Workspace>(vertex_count_));
+    }
+
+    template <typename Workspace>
+    void WorkspacePool<Workspace>::Release(std::unique_ptr<Workspace> workspace) const {
+        std::lock_guard lock(mutex_);
+        free_workspaces_.push_back(std::move(workspace));
+    }
+
+    // Precomputes the all-pairs table with Floyd-Warshall: O(V^3) time and
+    // O(V^2) memory, constant-time queries. Only suitable for small networks.
+    // Weights and last edges live in two flat row-major V x V arrays, and the
+    // relaxation runs tile by tile (blocked Floyd-Warshall), so that every phase
+    // of a round is spread over the available cores. Every pair still sees the
+    // vertices of a block in order, each with the values the plain vertex by
+    // vertex algorithm would use, so ties resolve exactly as there. Both arrays hold
+    // fixed-width values, so a router restored from a snapshot uses them in
+    // place, and processes mapping the same file share its pages.
+    template <typename Weight>
+    class Router : public RouterBase<Weight> {
+    private:
+        using Graph = CompactGraph<Weight>;
+
+    public:
+        Router(const Graph& graph, size_t thread_count = std::thread::hardware_concurrency());
+        // Extends base to graph, which is the graph of base with edges appended
+        // by the merging CompactGraph constructor; edge_order is its output.
+        // The tables of base are copied, since base stays in use: O(V^2). As
+        // edges are only added, every pair is then relaxed through the
+        // endpoints of the new edges alone: O(endpoints * V^2) instead of
+        // O(V^3). Both terms grow with the network, not only with the change.
+        Router(const Router& base, const Graph& graph, const std::vector<EdgeId>& edge_order,
+               size_t thread_count = std::thread::hardware_concurrency());
+        Router(const Graph& graph, Snapshot::Reader& reader);
+
+        std::optional<Weight> FindRouteEdges(VertexId from, VertexId to, std::vector<EdgeId>& edges) const override;
+        // A scan of the row of from.
+        std::vector<std::pair<VertexId, Weight>> FindReachable(VertexId from, Weight max_weight) const override;
+        void Save(Snapshot::Writer& writer) const override;
+
+    private:
+        // Edge ids of CompactGraph fit in 32 bits.
+        using TableEdgeId = uint32_t;
+
+        // Describes the tables in a snapshot, so that a file written for
+        // another graph or value layout is rejected rather than misread.
+        struct TableHeader {
+            uint64_t vertex_count;
+            uint32_t weight_size;
+            uint32_t edge_id_size;
+        };
+
+        static constexpr size_t BLOCK_SIZE = 64;
+        static constexpr Weight NO_ROUTE = std::numeric_limits<Weight>::max();
+        static constexpr TableEdgeId NO_EDGE = std::numeric_limits<TableEdgeId>::max();
 
-        void RelaxRoute(VertexId vertex_from, VertexId vertex_to,
-                        const RouteInternalData& route_from, const RouteInternalData& route_to) {
-            auto& route_relaxing = routes_internal_data_[vertex_from][vertex_to];
-            const Weight candidate_weight = route_from.weight + route_to.weight;
-            if (!route_relaxing || candidate_weight < route_relaxing->weight) {
-                route_relaxing = {
-                    candidate_weight,
-                    route_to.prev_edge
-                        ? route_to.prev_edge
-                        : route_from.prev_edge
-                };
+        const Graph& graph_;
+        const size_t vertex_count_;
+        const size_t thread_count_;
+
+        Snapshot::SharedArray<Weight> weights_;
+        Snapshot::SharedArray<TableEdgeId> prev_edges_;
+
+        size_t GetIndex(VertexId from, VertexId to) const {
+            return from * vertex_count_ + to;
+        }
+
+        void InitializeRoutesInternalData(const Graph& graph, Weight* weights, TableEdgeId* prev_edges) const {
+            for (VertexId vertex = 0; vertex < vertex_count_; ++vertex) {
+                weights[GetIndex(vertex, vertex)] = 0;
+                for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
+                    const Weight edge_weight = graph.GetEdgeWeight(edge_id);
+                    assert(edge_weight >= 0);
+                    const size_t idx = GetIndex(vertex, graph.GetEdgeTo(edge_id));
+                    if (weights[idx] > edge_weight) {
+                        weights[idx] = edge_weight;
+                        prev_edges[idx] = edge_id;
+                    }
+                }
             }
         }
 
-        void RelaxRoutesInternalDataThroughVertex(size_t vertex_count, VertexId vertex_through) {
-            for (VertexId vertex_from = 0; vertex_from < vertex_count; ++vertex_from) {
-                if (const auto& route_from = routes_internal_data_[vertex_from][vertex_through]) {
-                    for (VertexId vertex_to = 0; vertex_to < vertex_count; ++vertex_to) {
-                        if (const auto& route_to = routes_internal_data_[vertex_through][vertex_to]) {
-                            RelaxRoute(vertex_from, vertex_to, *route_from, *route_to);
+        // Rows and columns of the through block as they were just before the
+        // relaxation through each of its vertices: the value the plain
+        // algorithm reads, even where the tile that holds it has since gone
+        // through later vertices of the block.
+        struct ThroughBlock {
+            // V x BLOCK_SIZE: pair (from, through) at index from * BLOCK_SIZE + through offset.
+            std::vector<Weight> column_weights;
+            std::vector<TableEdgeId> column_prev_edges;
+            // BLOCK_SIZE x V: pair (through, to) at index through offset * V + to.
+            std::vector<Weight> row_weights;
+            std::vector<TableEdgeId> row_prev_edges;
+        };
+
+        // Relaxes the tile (from_block, to_block) through the vertices of
+        // through_block. A tile in the through column records the column of
+        // each through vertex before relaxing through it, and one in the
+        // through row records the row; the other tiles read the records.
+        void RelaxBlock(Weight* weights, TableEdgeId* prev_edges, size_t from_block, size_t to_block, size_t through_block,
+                        ThroughBlock& through) const {
+            const VertexId from_begin = from_block * BLOCK_SIZE;
+            const VertexId from_end = std::min(vertex_count_, from_begin + BLOCK_SIZE);
+            const VertexId to_begin = to_block * BLOCK_SIZE;
+            const VertexId to_end = std::min(vertex_count_, to_begin + BLOCK_SIZE);
+            const VertexId through_begin = through_block * BLOCK_SIZE;
+            const VertexId through_end = std::min(vertex_count_, through_begin + BLOCK_SIZE);
+            for (VertexId vertex_through = through_begin; vertex_through < through_end; ++vertex_through) {
+                const size_t through_offset = vertex_through - through_begin;
+                if (to_block == through_block) {
+                    for (VertexId vertex_from = from_begin; vertex_from < from_end; ++vertex_from) {
+                        through.column_weights[vertex_from * BLOCK_SIZE + through_offset] = weights[GetIndex(vertex_from, vertex_through)];
+                        through.column_prev_edges[vertex_from * BLOCK_SIZE + through_offset] = prev_edges[GetIndex(vertex_from, vertex_through)];
+                    }
+                }
+                Weight* through_weights = &through.row_weights[through_offset * vertex_count_];
+                TableEdgeId* through_prev_edges = &through.row_prev_edges[through_offset * vertex_count_];
+                if (from_block == through_block) {
+                    std::copy(&weights[GetIndex(vertex_through, to_begin)], &weights[GetIndex(vertex_through, to_end)],
+                              through_weights + to_begin);
+                    std::copy(&prev_edges[GetIndex(vertex_through, to_begin)], &prev_edges[GetIndex(vertex_through, to_end)],
+                              through_prev_edges + to_begin);
+                }
+                for (VertexId vertex_from = from_begin; vertex_from < from_end; ++vertex_from) {
+                    const Weight weight_from = through.column_weights[vertex_from * BLOCK_SIZE + through_offset];
+                    if (weight_from == NO_ROUTE) {
+                        continue;
+                    }
+                    const TableEdgeId prev_edge_from = through.column_prev_edges[vertex_from * BLOCK_SIZE + through_offset];
+                    Weight* from_weights = &weights[GetIndex(vertex_from, 0)];
+                    TableEdgeId* from_prev_edges = &prev_edges[GetIndex(vertex_from, 0)];
+                    for (VertexId vertex_to = to_begin; vertex_to < to_end; ++vertex_to) {
+                        if (through_weights[vertex_to] == NO_ROUTE) {
+                            continue;
+                        }
+                        const Weight candidate_weight = weight_from + through_weights[vertex_to];
+                        if (candidate_weight < from_weights[vertex_to]) {
+                            from_weights[vertex_to] = candidate_weight;
+                            from_prev_edges[vertex_to] = through_prev_edges[vertex_to] != NO_EDGE
+                                ? through_prev_edges[vertex_to]
+                                : prev_edge_from;
                         }
                     }
                 }
             }
         }
 
-        RoutesInternalData routes_internal_data_;
+        // Relaxes the pairs from one block of rows through one vertex. The row
+        // and column of that vertex stay unchanged, so blocks of rows may be
+        // relaxed in parallel.
+        void RelaxThrough(Weight* weights, TableEdgeId* prev_edges, VertexId vertex_through, size_t from_block) const {
+            const Weight* through_weights = &weights[GetIndex(vertex_through, 0)];
+            const TableEdgeId* through_prev_edges = &prev_edges[GetIndex(vertex_through, 0)];
+            const VertexId from_end = std::min(vertex_count_, (from_block + 1) * BLOCK_SIZE);
+            for (VertexId vertex_from = from_block * BLOCK_SIZE; vertex_from < from_end; ++vertex_from) {
+                const size_t through_idx = GetIndex(vertex_from, vertex_through);
+                const Weight weight_from = weights[through_idx];
+                if (weight_from == NO_ROUTE || vertex_from == vertex_through) {
+                    continue;
+                }
+                const TableEdgeId prev_edge_from = prev_edges[through_idx];
+                Weight* from_weights = &weights[GetIndex(vertex_from, 0)];
+                TableEdgeId* from_prev_edges = &prev_edges[GetIndex(vertex_from, 0)];
+                for (VertexId vertex_to = 0; vertex_to < vertex_count_; ++vertex_to) {
+                    if (through_weights[vertex_to] == NO_ROUTE) {
+                        continue;
+                    }
+                    const Weight candidate_weight = weight_from + through_weights[vertex_to];
+                    if (candidate_weight < from_weights[vertex_to]) {
+                        from_weights[vertex_to] = candidate_weight;
+                        from_prev_edges[vertex_to] = through_prev_edges[vertex_to] != NO_EDGE
+                            ? through_prev_edges[vertex_to]
+                            : prev_edge_from;
+                    }
+                }
+            }
+        }
+
+        // Runs phases one after another, calling task(phase, task_idx) for
+        // every task_idx below get_task_count(phase); the tasks of one phase
+        // run in parallel. The workers are started once for all phases and
+        // wait for each other at the end of every phase.
+        template <typename TaskCount, typename Task>
+        void ParallelPhases(size_t phase_count, size_t max_task_count, TaskCount get_task_count, Task task) const {
+            const size_t worker_count = std::min(thread_count_, max_task_count);
+            if (worker_count <= 1) {
+                for (size_t phase = 0; phase < phase_count; ++phase) {
+                    const size_t task_count = get_task_count(phase);
+                    for (size_t task_idx = 0; task_idx < task_count; ++task_idx) {
+                        task(phase, task_idx);
+                    }
+                }
+                return;
+            }
+            std::atomic<size_t> next_task = 0;
+            std::mutex mutex;
+            std::condition_variable phase_done;
+            size_t finished_phases = 0;
+            size_t arrived_workers = 0;
+            const auto run = [&] {
+                for (size_t phase = 0; phase < phase_count; ++phase) {
+                    const size_t task_count = get_task_count(phase);
+                    for (size_t task_idx = next_task++; task_idx < task_count; task_idx = next_task++) {
+                        task(phase, task_idx);
+                    }
+                    std::unique_lock lock(mutex);
+                    if (++arrived_workers == worker_count) {
+                        // Everyone else waits, so nobody takes a task meanwhile.
+                        arrived_workers = 0;
+                        next_task = 0;
+                        ++finished_phases;
+                        phase_done.notify_all();
+                    } else {
+                        phase_done.wait(lock, [&] { return finished_phases > phase; });
+                    }
+                }
+            };
+            std::vector<std::thread> workers;
+            workers.reserve(worker_count - 1);
+            for (size_t worker = 1; worker < worker_count; ++worker) {
+                workers.emplace_back(run);
+            }
+            run();
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+
+        void RelaxRoutesInternalData(Weight* weights, TableEdgeId* prev_edges) const {
+            const size_t block_count = (vertex_count_ + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            ThroughBlock through{
+                std::vector<Weight>(vertex_count_ * BLOCK_SIZE),
+                std::vector<TableEdgeId>(vertex_count_ * BLOCK_SIZE),
+                std::vector<Weight>(BLOCK_SIZE * vertex_count_),
+                std::vector<TableEdgeId>(BLOCK_SIZE * vertex_count_),
+            };
+            // Three phases per through block: the diagonal tile, then the
+            // tiles of its row and column, then all the others.
+            const auto get_task_count = [block_count](size_t phase) -> size_t {
+                switch (phase % 3) {
+                case 0:
+                    return 1;
+                case 1:
+                    return 2 * block_count;
+                default:
+                    return block_count;
+                }
+            };
+            ParallelPhases(3 * block_count, 2 * block_count, get_task_count, [&](size_t phase, size_t task_idx) {
+                const size_t through_block = phase / 3;
+                if (phase % 3 == 0) {
+                    RelaxBlock(weights, prev_edges, through_block, through_block, through_block, through);
+                } else if (phase % 3 == 1) {
+                    const size_t block = task_idx / 2;
+                    if (block == through_block) {
+                        return;
+                    }
+                    if (task_idx % 2 == 0) {
+                        RelaxBlock(weights, prev_edges, through_block, block, through_block, through);
+                    } else {
+                        RelaxBlock(weights, prev_edges, block, through_block, through_block, through);
+                    }
+                } else {
+                    const size_t from_block = task_idx;
+                    if (from_block == through_block) {
+                        return;
+                    }
+                    for (size_t to_block = 0; to_block < block_count; ++to_block) {
+                        if (to_block != through_block) {
+                            RelaxBlock(weights, prev_edges, from_block, to_block, through_block, through);
+                        }
+                    }
+                }
+            });
+        }
     };
 
 
     template <typename Weight>
-    Router<Weight>::Router(const Graph& graph)
+    Router<Weight>::Router(const Graph& graph, size_t thread_count)
         : graph_(graph),
-        routes_internal_data_(graph.GetVertexCount(), std::vector<std::optional<RouteInternalData>>(graph.GetVertexCount()))
+        vertex_count_(graph.GetVertexCount()),
+        thread_count_(std::max<size_t>(thread_count, 1))
     {
-        InitializeRoutesInternalData(graph);
+        std::vector<Weight> weights(vertex_count_ * vertex_count_, NO_ROUTE);
+        std::vector<TableEdgeId> prev_edges(vertex_count_ * vertex_count_, NO_EDGE);
+        InitializeRoutesInternalData(graph, weights.data(), prev_edges.data());
+        RelaxRoutesInternalData(weights.data(), prev_edges.data());
+        weights_ = Snapshot::SharedArray<Weight>(std::move(weights));
+        prev_edges_ = Snapshot::SharedArray<TableEdgeId>(std::move(prev_edges));
+    }
+
+    template <typename Weight>
+    Router<Weight>::Router(const Router& base, const Graph& graph, const std::vector<EdgeId>& edge_order, size_t thread_count)
+        : graph_(graph),
+        vertex_count_(graph.GetVertexCount()),
+        thread_count_(std::max<size_t>(thread_count, 1))
+    {
+        const size_t base_vertex_count = base.vertex_count_;
+        const size_t base_edge_count = base.graph_.GetEdgeCount();
+        assert(vertex_count_ >= base_vertex_count && edge_order.size() == graph.GetEdgeCount());
+        std::vector<TableEdgeId> new_edge_ids(base_edge_count, NO_EDGE);
+        for (EdgeId edge_id = 0; edge_id < edge_order.size(); ++edge_id) {
+            if (edge_order[edge_id] < base_edge_count) {
+                new_edge_ids[edge_order[edge_id]] = edge_id;
+            }
+        }
+
+        std::vector<Weight> weights(vertex_count_ * vertex_count_, NO_ROUTE);
+        std::vector<TableEdgeId> prev_edges(vertex_count_ * vertex_count_, NO_EDGE);
+        for (VertexId vertex_from = 0; vertex_from < base_vertex_count; ++vertex_from) {
+            const size_t base_row = base.GetIndex(vertex_from, 0);
+            std::copy(base.weights_.begin() + base_row, base.weights_.begin() + base_row + base_vertex_count,
+                      weights.begin() + GetIndex(vertex_from, 0));
+            for (VertexId vertex_to = 0; vertex_to < base_vertex_count; ++vertex_to) {
+                const TableEdgeId prev_edge = base.prev_edges_[base_row + vertex_to];
+                prev_edges[GetIndex(vertex_from, vertex_to)] = prev_edge == NO_EDGE ? NO_EDGE : new_edge_ids[prev_edge];
+            }
+        }
+        for (VertexId vertex = base_vertex_count; vertex < vertex_count_; ++vertex) {
+            weights[GetIndex(vertex, vertex)] = 0;
+        }
 
-        const size_t vertex_count = graph.GetVertexCount();
-        for (VertexId vertex_through = 0; vertex_through < vertex_count; ++vertex_through) {
-            RelaxRoutesInternalDataThroughVertex(vertex_count, vertex_through);
+        std::vector<bool> is_through(vertex_count_, false);
+        for (EdgeId edge_id = 0; edge_id < edge_order.size(); ++edge_id) {
+            if (edge_order[edge_id] < base_edge_count) {
+                continue;
+            }
+            const auto edge = graph.GetEdge(edge_id);
+            assert(edge.weight >= 0);
+            const size_t idx = GetIndex(edge.from, edge.to);
+            if (weights[idx] > edge.weight) {
+                weights[idx] = edge.weight;
+                prev_edges[idx] = edge_id;
+            }
+            is_through[edge.from] = true;
+            is_through[edge.to] = true;
+        }
+        std::vector<VertexId> through_vertices;
+        for (VertexId vertex_through = 0; vertex_through < vertex_count_; ++vertex_through) {
+            if (is_through[vertex_through]) {
+                through_vertices.push_back(vertex_through);
+            }
         }
+        const size_t block_count = (vertex_count_ + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        ParallelPhases(through_vertices.size(), block_count, [block_count](size_t) { return block_count; },
+                       [&](size_t phase, size_t from_block) {
+            RelaxThrough(weights.data(), prev_edges.data(), through_vertices[phase], from_block);
+        });
+        weights_ = Snapshot::SharedArray<Weight>(std::move(weights));
+        prev_edges_ = Snapshot::SharedArray<TableEdgeId>(std::move(prev_edges));
     }
 
     template <typename Weight>
-    std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexId from, VertexId to) const {
-        const auto& route_internal_data = routes_internal_data_[from][to];
-        if (!route_internal_data) {
-            return std::nullopt;
+    Router<Weight>::Router(const Graph& graph, Snapshot::Reader& reader)
+        : graph_(graph),
+        vertex_count_(graph.GetVertexCount()),
+        thread_count_(1)
+    {
+        const auto header = reader.Read<TableHeader>();
+        if (header.vertex_count != vertex_count_ || header.weight_size != sizeof(Weight) || header.edge_id_size != sizeof(TableEdgeId)) {
+            throw std::runtime_error("snapshot: routes table does not match the graph");
         }
-        const Weight weight = route_internal_data->weight;
-        std::vector<EdgeId> edges;
-        for (std::optional<EdgeId> edge_id = route_internal_data->prev_edge;
-                edge_id;
-                edge_id = routes_internal_data_[from][graph_.GetEdge(*edge_id).from]->prev_edge) {
-            edges.push_back(*edge_id);
+        weights_ = reader.ReadShared<Weight>();
+        prev_edges_ = reader.ReadShared<TableEdgeId>();
+        if (weights_.size() != vertex_count_ * vertex_count_ || prev_edges_.size() != weights_.size()) {
+            throw std::runtime_error("snapshot: routes table does not match the graph");
         }
-        std::reverse(std::begin(edges), std::end(edges));
+    }
 
-        const RouteId route_id = next_route_id_++;
-        const size_t route_edge_count = edges.size();
-        expanded_routes_cache_[route_id] = std::move(edges);
-        return RouteInfo{route_id, weight, route_edge_count};
+    template <typename Weight>
+    void Router<Weight>::Save(Snapshot::Writer& writer) const {
+        writer.Write(TableHeader{vertex_count_, sizeof(Weight), sizeof(TableEdgeId)});
+        writer.WriteVector(weights_);
+        writer.WriteVector(prev_edges_);
     }
 
     template <typename Weight>
-    EdgeId Router<Weight>::GetRouteEdge(RouteId route_id, size_t edge_idx) const {
-        return expanded_routes_cache_.at(route_id)[edge_idx];
+    std::optional<Weight> Router<Weight>::FindRouteEdges(VertexId from, VertexId to, std::vector<EdgeId>& edges) const {
+        const Weight weight = weights_[GetIndex(from, to)];
+        if (weight == NO_ROUTE) {
+            return std::nullopt;
+        }
+        edges.clear();
+        for (TableEdgeId edge_id = prev_edges_[GetIndex(from, to)];
+                edge_id != NO_EDGE;
+                edge_id = prev_edges_[GetIndex(from, graph_.GetEdgeFrom(edge_id))]) {
+            edges.push_back(edge_id);
+        }
+        std::reverse(std::begin(edges), std::end(edges));
+        return weight;
     }
 
     template <typename Weight>
-    void Router<Weight>::ReleaseRoute(RouteId route_id) {
-        expanded_routes_cache_.erase(route_id);
+    std::vector<std::pair<VertexId, Weight>> Router<Weight>::FindReachable(VertexId from, Weight max_weight) const {
+        std::vector<std::pair<VertexId, Weight>> reachable;
+        const Weight* row = &weights_[GetIndex(from, 0)];
+        for (VertexId to = 0; to < vertex_count_; ++to) {
+            if (row[to] != NO_ROUTE && row[to] <= max_weight) {
+                reachable.emplace_back(to, row[to]);
+            }
+        }
+        return reachable;
     }
 
 }
@@ -0,0 +1,384 @@
+#include "contraction_router.h"
+#include "dijkstra_router.h"
+#include "graph.h"
+#include "pareto_router.h"
+#include "router.h"
+#include "test_runner.h"
+#include "yen_router.h"
+
+#include <queue>
+#include <random>
+#include <set>
+#include <tuple>
+
+// Build: g++ -std=c++17 -pthread router_test.cpp snapshot.cpp input_buffer.cpp
+
+using namespace Graph;
+
+// Small integer weights, so that many routes tie.
+DirectedWeightedGraph<double> MakeRandomGraph(mt19937& random, size_t vertex_count, size_t edge_count, int max_weight) {
+    DirectedWeightedGraph<double> graph(vertex_count);
+    for (size_t edge = 0; edge < edge_count; ++edge) {
+        graph.AddEdge({random() % vertex_count, random() % vertex_count, static_cast<double>(random() % (max_weight + 1))});
+    }
+    return graph;
+}
+
+// Checks that edges lead from from to to and returns their total weight.
+double GetPathWeight(const CompactGraph<double>& graph, VertexId from, VertexId to, const vector<EdgeId>& edges) {
+    double weight = 0;
+    VertexId vertex = from;
+    for (const EdgeId edge_id : edges) {
+        ASSERT_EQUAL(graph.GetEdgeFrom(edge_id), vertex);
+        vertex = graph.GetEdgeTo(edge_id);
+        weight += graph.GetEdgeWeight(edge_id);
+    }
+    ASSERT_EQUAL(vertex, to);
+    return weight;
+}
+
+// Routes of the plain vertex by vertex Floyd-Warshall that the all-pairs
+// router started from: a route is only replaced by a strictly lighter one.
+vector<vector<optional<vector<EdgeId>>>> FindPlainFloydWarshallRoutes(const CompactGraph<double>& graph) {
+    const size_t vertex_count = graph.GetVertexCount();
+    struct RouteData {
+        double weight;
+        optional<EdgeId> prev_edge;
+    };
+    vector<vector<optional<RouteData>>> routes(vertex_count, vector<optional<RouteData>>(vertex_count));
+    for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+        routes[vertex][vertex] = RouteData{0, nullopt};
+        for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
+            auto& route = routes[vertex][graph.GetEdgeTo(edge_id)];
+            if (!route || route->weight > graph.GetEdgeWeight(edge_id)) {
+                route = RouteData{graph.GetEdgeWeight(edge_id), edge_id};
+            }
+        }
+    }
+    for (VertexId through = 0; through < vertex_count; ++through) {
+        for (VertexId from = 0; from < vertex_count; ++from) {
+            const auto route_from = routes[from][through];
+            if (!route_from) {
+                continue;
+            }
+            for (VertexId to = 0; to < vertex_count; ++to) {
+                const auto& route_to = routes[through][to];
+                if (!route_to) {
+                    continue;
+                }
+                auto& route = routes[from][to];
+                const double weight = route_from->weight + route_to->weight;
+                if (!route || weight < route->weight) {
+                    route = RouteData{weight, route_to->prev_edge ? route_to->prev_edge : route_from->prev_edge};
+                }
+            }
+        }
+    }
+    vector<vector<optional<vector<EdgeId>>>> result(vertex_count, vector<optional<vector<EdgeId>>>(vertex_count));
+    for (VertexId from = 0; from < vertex_count; ++from) {
+        for (VertexId to = 0; to < vertex_count; ++to) {
+            if (!routes[from][to]) {
+                continue;
+            }
+            auto& edges = result[from][to].emplace();
+            for (auto edge_id = routes[from][to]->prev_edge; edge_id; edge_id = routes[from][graph.GetEdgeFrom(*edge_id)]->prev_edge) {
+                edges.push_back(*edge_id);
+            }
+            reverse(edges.begin(), edges.end());
+        }
+    }
+    return result;
+}
+
+// The Pareto front from from to to by a Dijkstra over (vertex, count)
+// layers: the lightest route for every count, kept while it beats every lower
+// count. Sorted by weight, as ParetoRouter returns it.
+vector<pair<double, uint32_t>> FindParetoFrontByLayers(const CompactGraph<double>& graph, const vector<uint8_t>& edge_counts,
+                                                       VertexId from, VertexId to) {
+    // Cutting a cycle out of a route adds neither weight nor count, so the
+    // front has loopless routes, of fewer edges than there are vertices.
+    const uint32_t max_count = graph.GetVertexCount() - 1;
+    vector<vector<optional<double>>> weights(graph.GetVertexCount(), vector<optional<double>>(max_count + 1));
+    using QueueItem = tuple<double, VertexId, uint32_t>;
+    priority_queue<QueueItem, vector<QueueItem>, greater<QueueItem>> queue;
+    weights[from][0] = 0;
+    queue.push({0, from, 0});
+    while (!queue.empty()) {
+        const auto [weight, vertex, count] = queue.top();
+        queue.pop();
+        if (weight > *weights[vertex][count]) {
+            continue;
+        }
+        for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
+            const uint32_t edge_count = count + edge_counts[edge_id];
+            const VertexId edge_to = graph.GetEdgeTo(edge_id);
+            const double edge_weight = weight + graph.GetEdgeWeight(edge_id);
+            if (edge_count <= max_count && (!weights[edge_to][edge_count] || edge_weight < *weights[edge_to][edge_count])) {
+                weights[edge_to][edge_count] = edge_weight;
+                queue.push({edge_weight, edge_to, edge_count});
+            }
+        }
+    }
+    vector<pair<double, uint32_t>> front;
+    for (uint32_t count = 0; count <= max_count; ++count) {
+        if (weights[to][count] && (front.empty() || *weights[to][count] < front.back().first)) {
+            front.push_back({*weights[to][count], count});
+        }
+    }
+    reverse(front.begin(), front.end());
+    return front;
+}
+
+// Weights of every loopless route from vertex to to, by depth-first search.
+void EnumerateLooplessRoutes(const CompactGraph<double>& graph, VertexId vertex, VertexId to, double weight,
+                             size_t edge_count, vector<bool>& visited, vector<pair<double, size_t>>& routes) {
+    if (vertex == to) {
+        routes.push_back({weight, edge_count});
+        return;
+    }
+    for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
+        const VertexId edge_to = graph.GetEdgeTo(edge_id);
+        if (!visited[edge_to]) {
+            visited[edge_to] = true;
+            EnumerateLooplessRoutes(graph, edge_to, to, weight + graph.GetEdgeWeight(edge_id), edge_count + 1, visited, routes);
+            visited[edge_to] = false;
+        }
+    }
+}
+
+// Ties, and sums that round differently when added up in another order,
+// come out as in the plain algorithm, over several blocks and threads.
+void TestAllPairsMatchesPlainFloydWarshall() {
+    mt19937 random(3);
+    for (int iteration = 0; iteration < 12; ++iteration) {
+        const size_t vertex_count = 2 + random() % 200;
+        DirectedWeightedGraph<double> source(vertex_count);
+        for (size_t edge = 0; edge < 3 * vertex_count; ++edge) {
+            // Tenths do not add up exactly in binary.
+            source.AddEdge({random() % vertex_count, random() % vertex_count, static_cast<double>(random() % 4) / 10});
+        }
+        const CompactGraph<double> graph(source);
+        const auto expected = FindPlainFloydWarshallRoutes(graph);
+        for (const size_t thread_count : {1, 4}) {
+            const Router<double> all_pairs(graph, thread_count);
+            for (VertexId from = 0; from < vertex_count; ++from) {
+                for (VertexId to = 0; to < vertex_count; ++to) {
+                    const auto route = all_pairs.FindRoute(from, to);
+                    ASSERT_EQUAL(route.has_value(), expected[from][to].has_value());
+                    if (route) {
+                        ASSERT_EQUAL(route->edges, *expected[from][to]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Extends a router with edges over old and new vertices, on one thread and
+// on several; both must find the weights of a router built from scratch.
+void TestAllPairsExtensionMatchesRebuild() {
+    mt19937 random(11);
+    for (int iteration = 0; iteration < 20; ++iteration) {
+        const size_t base_vertex_count = 2 + random() % 150;
+        const size_t vertex_count = base_vertex_count + random() % 20;
+        const CompactGraph<double> base_graph(MakeRandomGraph(random, base_vertex_count, 2 * base_vertex_count, 5));
+        const DirectedWeightedGraph<double> added = MakeRandomGraph(random, vertex_count, 1 + random() % 10, 5);
+        vector<EdgeId> edge_order;
+        const CompactGraph<double> graph(base_graph, added, &edge_order);
+        const Router<double> rebuilt(graph, 1);
+        for (const size_t thread_count : {1, 4}) {
+            const Router<double> base(base_graph, thread_count);
+            const Router<double> extended(base, graph, edge_order, thread_count);
+            for (VertexId from = 0; from < vertex_count; ++from) {
+                for (VertexId to = 0; to < vertex_count; ++to) {
+                    const auto expected = rebuilt.FindRoute(from, to);
+                    const auto route = extended.FindRoute(from, to);
+                    ASSERT_EQUAL(route.has_value(), expected.has_value());
+                    if (route) {
+                        ASSERT_EQUAL(route->weight, expected->weight);
+                        ASSERT_EQUAL(GetPathWeight(graph, from, to, route->edges), route->weight);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void TestContractionHierarchiesWeights() {
+    mt19937 random(2);
+    for (int iteration = 0; iteration < 50; ++iteration) {
+        const size_t vertex_count = 2 + random() % 40;
+        const CompactGraph<double> graph(MakeRandomGraph(random, vertex_count, random() % (4 * vertex_count), 5));
+        const Router<double> all_pairs(graph, 1);
+        const ContractionHierarchiesRouter<double> hierarchies(graph);
+        for (VertexId from = 0; from < vertex_count; ++from) {
+            for (VertexId to = 0; to < vertex_count; ++to) {
+                const auto expected = all_pairs.FindRoute(from, to);
+                const auto route = hierarchies.FindRoute(from, to);
+                ASSERT_EQUAL(route.has_value(), expected.has_value());
+                if (route) {
+                    ASSERT_EQUAL(route->weight, expected->weight);
+                    ASSERT_EQUAL(GetPathWeight(graph, from, to, route->edges), route->weight);
+                }
+            }
+        }
+    }
+}
+
+// One router answers every query, so each one relies on the labels of the
+// previous ones being reset by their stamps.
+void TestDijkstraRouterWeights() {
+    mt19937 random(5);
+    for (int iteration = 0; iteration < 50; ++iteration) {
+        const size_t vertex_count = 2 + random() % 40;
+        const CompactGraph<double> graph(MakeRandomGraph(random, vertex_count, random() % (4 * vertex_count), 5));
+        const Router<double> all_pairs(graph, 1);
+        const DijkstraRouter<double> dijkstra(graph);
+        for (VertexId from = 0; from < vertex_count; ++from) {
+            for (VertexId to = 0; to < vertex_count; ++to) {
+                const auto expected = all_pairs.FindRoute(from, to);
+                const auto route = dijkstra.FindRoute(from, to);
+                ASSERT_EQUAL(route.has_value(), expected.has_value());
+                if (route) {
+                    ASSERT_EQUAL(route->weight, expected->weight);
+                    ASSERT_EQUAL(GetPathWeight(graph, from, to, route->edges), route->weight);
+                }
+            }
+
+            // Targets repeat and include the source; the search stops at
+            // the last of them.
+            vector<VertexId> targets;
+            for (size_t target = random() % 5; target > 0; --target) {
+                targets.push_back(random() % vertex_count);
+            }
+            if (!targets.empty()) {
+                targets.push_back(targets.front());
+            }
+            targets.push_back(from);
+            const auto routes = dijkstra.FindRoutes(from, targets, true);
+            ASSERT_EQUAL(routes.size(), targets.size());
+            for (size_t i = 0; i < targets.size(); ++i) {
+                const auto expected = all_pairs.FindRoute(from, targets[i]);
+                ASSERT_EQUAL(routes[i].has_value(), expected.has_value());
+                if (routes[i]) {
+                    ASSERT_EQUAL(routes[i]->weight, expected->weight);
+                    ASSERT_EQUAL(GetPathWeight(graph, from, targets[i], routes[i]->edges), routes[i]->weight);
+                }
+            }
+
+            const double max_weight = random() % 12;
+            auto reachable = dijkstra.FindReachable(from, max_weight);
+            auto expected_reachable = all_pairs.FindReachable(from, max_weight);
+            sort(reachable.begin(), reachable.end());
+            sort(expected_reachable.begin(), expected_reachable.end());
+            ASSERT(reachable == expected_reachable);
+        }
+    }
+}
+
+// Where routes tie, only the weight is the same as that of the all-pairs
+// router: either route may come back.
+void TestContractionHierarchiesTies() {
+    DirectedWeightedGraph<double> source(4);
+    source.AddEdge({0, 1, 1});
+    source.AddEdge({0, 2, 1});
+    source.AddEdge({1, 3, 1});
+    source.AddEdge({2, 3, 1});
+    const CompactGraph<double> graph(source);
+    const ContractionHierarchiesRouter<double> hierarchies(graph);
+    const auto route = hierarchies.FindRoute(0, 3);
+    ASSERT(route.has_value());
+    ASSERT_EQUAL(route->weight, 2.0);
+    ASSERT_EQUAL(route->edges.size(), 2u);
+    ASSERT_EQUAL(GetPathWeight(graph, 0, 3, route->edges), 2.0);
+}
+
+void TestParetoRouterMatchesLayeredDijkstra() {
+    mt19937 random(7);
+    for (int iteration = 0; iteration < 100; ++iteration) {
+        const size_t vertex_count = 2 + random() % 30;
+        const CompactGraph<double> graph(MakeRandomGraph(random, vertex_count, random() % (4 * vertex_count), 5));
+        vector<uint8_t> edge_counts(graph.GetEdgeCount());
+        for (auto& count : edge_counts) {
+            count = random() % 2;
+        }
+        const ParetoRouter<double> pareto(graph, edge_counts);
+        for (VertexId from = 0; from < vertex_count; ++from) {
+            for (VertexId to = 0; to < vertex_count; ++to) {
+                vector<pair<double, uint32_t>> front;
+                for (const auto& route : pareto.FindRoutes(from, to)) {
+                    ASSERT_EQUAL(GetPathWeight(graph, from, to, route.edges), route.weight);
+                    uint32_t count = 0;
+                    for (const EdgeId edge_id : route.edges) {
+                        count += edge_counts[edge_id];
+                    }
+                    ASSERT_EQUAL(count, route.count);
+                    front.push_back({route.weight, route.count});
+                }
+                const auto expected = FindParetoFrontByLayers(graph, edge_counts, from, to);
+                ASSERT_EQUAL(front.size(), expected.size());
+                for (size_t idx = 0; idx < front.size(); ++idx) {
+                    ASSERT_EQUAL(front[idx].first, expected[idx].first);
+                    ASSERT_EQUAL(front[idx].second, expected[idx].second);
+                }
+            }
+        }
+    }
+}
+
+// The routes Yen's algorithm passes on are distinct and loopless, and their
+// weights are the lightest of all loopless routes, found by enumerating them.
+// Rejecting routes with an odd number of edges leaves the lightest even ones.
+void TestYenRouterMatchesEnumeration() {
+    mt19937 random(3);
+    for (int iteration = 0; iteration < 300; ++iteration) {
+        const size_t vertex_count = 2 + random() % 8;
+        const CompactGraph<double> graph(MakeRandomGraph(random, vertex_count, random() % (3 * vertex_count), 4));
+        const YenRouter<double> yen(graph);
+        for (VertexId from = 0; from < vertex_count; ++from) {
+            for (VertexId to = 0; to < vertex_count; ++to) {
+                vector<pair<double, size_t>> all_routes;
+                vector<bool> visited(vertex_count);
+                visited[from] = true;
+                EnumerateLooplessRoutes(graph, from, to, 0, 0, visited, all_routes);
+                sort(all_routes.begin(), all_routes.end());
+                const size_t count = 1 + random() % 6;
+                for (const bool is_even_only : {false, true}) {
+                    vector<double> expected;
+                    for (const auto& [weight, edge_count] : all_routes) {
+                        if (expected.size() < count && (!is_even_only || edge_count % 2 == 0)) {
+                            expected.push_back(weight);
+                        }
+                    }
+                    vector<double> weights;
+                    set<vector<EdgeId>> routes;
+                    yen.FindRoutes(from, to, count, all_routes.size(), [&](const vector<EdgeId>& edges) {
+                        ASSERT(routes.insert(edges).second);
+                        set<VertexId> vertices{from};
+                        for (const EdgeId edge_id : edges) {
+                            ASSERT(vertices.insert(graph.GetEdgeTo(edge_id)).second);
+                        }
+                        if (is_even_only && edges.size() % 2 != 0) {
+                            return false;
+                        }
+                        weights.push_back(GetPathWeight(graph, from, to, edges));
+                        return true;
+                    });
+                    ASSERT_EQUAL(weights, expected);
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    TestRunner tr;
+    RUN_TEST(tr, TestAllPairsMatchesPlainFloydWarshall);
+    RUN_TEST(tr, TestAllPairsExtensionMatchesRebuild);
+    RUN_TEST(tr, TestContractionHierarchiesWeights);
+    RUN_TEST(tr, TestDijkstraRouterWeights);
+    RUN_TEST(tr, TestContractionHierarchiesTies);
+    RUN_TEST(tr, TestParetoRouterMatchesLayeredDijkstra);
+    RUN_TEST(tr, TestYenRouterMatchesEnumeration);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "snapshot.h"
+#include "input_buffer.h"
+
+#include <cstdio>
+#include <fstream>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+namespace Snapshot {
+
+    namespace {
+        constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+        constexpr uint64_t FNV_PRIME = 1099511628211ull;
+        constexpr size_t HEADER_SIZE = ALIGNMENT;
+
+        static_assert(sizeof(Header) <= HEADER_SIZE);
+    }
+
+    uint64_t ComputeChecksum(const char* data, size_t size) {
+        uint64_t hash = FNV_OFFSET_BASIS;
+        size_t pos = 0;
+        for (; pos + sizeof(uint64_t) <= size; pos += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, data + pos, sizeof(word));
+            hash = (hash ^ word) * FNV_PRIME;
+        }
+        for (; pos < size; ++pos) {
+            hash = (hash ^ static_cast<unsigned char>(data[pos])) * FNV_PRIME;
+        }
+        return hash;
+    }
+
+    void Writer::SaveFile(const string& path) const {
+        Header header{};
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.header_size = HEADER_SIZE;
+        header.payload_size = payload_.size();
+        header.checksum = ComputeChecksum(payload_.data(), payload_.size());
+
+        string header_bytes(HEADER_SIZE, '\0');
+        memcpy(header_bytes.data(), &header, sizeof(header));
+
+        const string temp_path = path + ".tmp";
+        {
+            ofstream out(temp_path, ios::binary | ios::trunc);
+            out.write(header_bytes.data(), header_bytes.size());
+            out.write(payload_.data(), payload_.size());
+            if (!out) {
+                throw runtime_error("snapshot: cannot write " + temp_path);
+            }
+        }
+        if (rename(temp_path.c_str(), path.c_str()) != 0) {
+            remove(temp_path.c_str());
+            throw runtime_error("snapshot: cannot replace " + path);
+        }
+    }
+
+    Reader::Reader(const string& path, bool verify_checksum) {
+        auto input = Input::ReadFile(path);
+        storage_ = move(input.data);
+        const char* data = storage_.get();
+        if (input.size < HEADER_SIZE) {
+            Fail("file too short");
+        }
+        if (reinterpret_cast<uintptr_t>(data) % alignof(uint64_t) != 0) {
+            Fail("misaligned mapping");
+        }
+        Header header;
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+            Fail("not a snapshot");
+        }
+        if (header.version != VERSION) {
+            Fail("unsupported version");
+        }
+        if (header.header_size != HEADER_SIZE || header.payload_size != input.size - HEADER_SIZE) {
+            Fail("size mismatch");
+        }
+        payload_ = data + HEADER_SIZE;
+        payload_size_ = header.payload_size;
+        if (verify_checksum && ComputeChecksum(payload_, payload_size_) != header.checksum) {
+            Fail("checksum mismatch");
+        }
+#ifndef _WIN32
+        // Tables are then read in place by queries, in no particular order.
+        madvise(const_cast<char*>(data), input.size, MADV_RANDOM);
+#endif
+    }
+
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Binary image of a built model. The file is a fixed header followed by a
+// payload of values and arrays written one after another; both sides agree on
+// the order, and VERSION changes whenever it does. Every array starts at an
+// ALIGNMENT boundary of the file, so a mapped snapshot can be read in place.
+namespace Snapshot {
+
+    inline constexpr uint32_t VERSION = 10;
+    inline constexpr size_t ALIGNMENT = 64;
+    inline constexpr char MAGIC[8] = {'T', 'M', 'S', 'N', 'A', 'P', '\0', '\0'};
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        uint64_t payload_size;
+        uint64_t checksum;
+    };
+
+    // FNV-1a over 64-bit words, then over the remaining bytes.
+    uint64_t ComputeChecksum(const char* data, size_t size);
+
+    template <typename T>
+    class ArrayView {
+    public:
+        ArrayView() = default;
+        ArrayView(const T* data, size_t size) : data_(data), size_(size) {}
+
+        const T* begin() const { return data_; }
+        const T* end() const { return data_ + size_; }
+        const T* data() const { return data_; }
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+        const T& operator[](size_t idx) const { return data_[idx]; }
+
+    private:
+        const T* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    // Read-only array that either owns its elements or views them in a mapped
+    // snapshot. Either way it holds a reference to its storage, so copies are
+    // cheap and a mapped file stays mapped while any array uses it.
+    template <typename T>
+    class SharedArray {
+    public:
+        SharedArray() = default;
+        explicit SharedArray(std::vector<T> values) {
+            auto owner = std::make_shared<const std::vector<T>>(std::move(values));
+            data_ = owner->data();
+            size_ = owner->size();
+            owner_ = std::move(owner);
+        }
+        SharedArray(ArrayView<T> view, std::shared_ptr<const char> storage)
+            : owner_(std::move(storage)), data_(view.data()), size_(view.size()) {}
+
+        const T* begin() const { return data_; }
+        const T* end() const { return data_ + size_; }
+        const T* data() const { return data_; }
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+        const T& operator[](size_t idx) const { return data_[idx]; }
+        const T& back() const { return data_[size_ - 1]; }
+
+    private:
+        std::shared_ptr<const void> owner_;
+        const T* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    class Writer {
+    public:
+        template <typename T>
+        void Write(const T& value) {
+            static_assert(std::is_trivially_copyable_v<T>);
+            payload_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        // Writes the element count, then the elements from an aligned offset.
+        template <typename T>
+        void WriteArray(const T* data, size_t count) {
+            static_assert(std::is_trivially_copyable_v<T>);
+            Write<uint64_t>(count);
+            Align();
+            payload_.append(reinterpret_cast<const char*>(data), count * sizeof(T));
+        }
+
+        template <typename T>
+        void WriteVector(const std::vector<T>& values) {
+            WriteArray(values.data(), values.size());
+        }
+
+        template <typename T>
+        void WriteVector(const SharedArray<T>& values) {
+            WriteArray(values.data(), values.size());
+        }
+
+        void WriteString(std::string_view text) {
+            WriteArray(text.data(), text.size());
+        }
+
+        // Writes a temporary file next to path and renames it over path, so
+        // readers never see a partly written snapshot.
+        void SaveFile(const std::string& path) const;
+
+    private:
+        std::string payload_;
+
+        void Align() {
+            payload_.resize((payload_.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT, '\0');
+        }
+    };
+
+    // Maps a snapshot and checks its header; throws runtime_error when the file
+    // is not a snapshot of this VERSION, is cut short or, if asked to verify it,
+    // fails its checksum. Arrays are returned as views into the mapping, which
+    // the reader shares with them.
+    class Reader {
+    public:
+        // Checks the header and the file size. Only with verify_checksum does
+        // it also read the whole payload to check its checksum, which faults in
+        // every page of the mapping before the first query.
+        explicit Reader(const std::string& path, bool verify_checksum = false);
+
+        template <typename T>
+        T Read() {
+            static_assert(std::is_trivially_copyable_v<T>);
+            Require(sizeof(T));
+            T value;
+            std::memcpy(&value, payload_ + pos_, sizeof(T));
+            pos_ += sizeof(T);
+            return value;
+        }
+
+        template <typename T>
+        ArrayView<T> ReadArray() {
+            static_assert(std::is_trivially_copyable_v<T>);
+            const size_t count = Read<uint64_t>();
+            Align();
+            if (count > (payload_size_ - pos_) / sizeof(T)) {
+                Fail("array out of bounds");
+            }
+            const T* data = reinterpret_cast<const T*>(payload_ + pos_);
+            pos_ += count * sizeof(T);
+            return {data, count};
+        }
+
+        template <typename T>
+        std::vector<T> ReadVector() {
+            const auto values = ReadArray<T>();
+            return {values.begin(), values.end()};
+        }
+
+        // Zero-copy: the array is used in place in the mapping.
+        template <typename T>
+        SharedArray<T> ReadShared() {
+            return {ReadArray<T>(), storage_};
+        }
+
+        std::string_view ReadString() {
+            const auto chars = ReadArray<char>();
+            return {chars.data(), chars.size()};
+        }
+
+        // Owner of the mapping, for structures that keep views into it.
+        const std::shared_ptr<const char>& GetStorage() const { return storage_; }
+
+    private:
+        std::shared_ptr<const char> storage_;
+        const char* payload_ = nullptr;
+        size_t payload_size_ = 0;
+        size_t pos_ = 0;
+
+        [[noreturn]] void Fail(const char* message) const {
+            throw std::runtime_error(std::string("snapshot: ") + message);
+        }
+
+        void Require(size_t size) const {
+            if (size > payload_size_ - pos_) {
+                Fail("unexpected end of payload");
+            }
+        }
+
+        void Align() {
+            const size_t aligned = (pos_ + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+            Require(aligned - pos_);
+            pos_ = aligned;
+        }
+    };
+
+}
@@ -107,8 +107,17 @@ namespace Svg {
 	}
 
 	void Document::Render(std::ostream& out) const {
+		RenderHeader(out);
+		RenderObjects(out);
+		RenderFooter(out);
+	}
+
+	void Document::RenderHeader(std::ostream& out) {
 		out << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?> ";
 		out << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\"> ";
+	}
+
+	void Document::RenderObjects(std::ostream& out) const {
 		for (const auto& object : objects_pool) {
 			switch (object.type) {
 			case Type::CIRCLE: {
@@ -132,6 +141,9 @@ namespace Svg {
 			}
 			}
 		}
+	}
+
+	void Document::RenderFooter(std::ostream& out) {
 		out << " </svg>";
 	}
 
@@ -258,6 +258,11 @@ namespace Svg {
 
 		void Render(std::ostream& out) const;
 
+		// The parts of Render, for drawing one document over a pre-rendered one.
+		static void RenderHeader(std::ostream& out);
+		void RenderObjects(std::ostream& out) const;
+		static void RenderFooter(std::ostream& out);
+
 		void Remove(size_t position);
 
 		size_t Size() const { return objects_pool.size(); }
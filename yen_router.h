@@ -0,0 +1,218 @@
+#pragma once
+
+#include "graph.h"
+#include "router.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace Graph {
+
+    // Loopless routes in order of weight with Yen's algorithm. Every next route
+    // leaves one found before at some vertex: for each vertex of the last found
+    // route, a Dijkstra runs from it to the target with the route prefix up to
+    // it removed, along with the edges that found routes with the same prefix
+    // take from it. The cheapest of these deviations, kept across rounds, is
+    // the next route. Candidates wait in a heap, and a set of their edge
+    // sequences keeps out repeats. Deviation searches reuse pooled workspaces.
+    template <typename Weight>
+    class YenRouter {
+    private:
+        using Graph = CompactGraph<Weight>;
+
+    public:
+        using Route = typename RouterBase<Weight>::Route;
+
+        explicit YenRouter(const Graph& graph);
+
+        // Passes the edges of every route, in order of weight, to on_route,
+        // which returns whether it accepts the route; stops once count routes
+        // are accepted or max_routes are passed in all. Rejected routes still
+        // branch into later ones. May be called concurrently.
+        template <typename OnRoute>
+        void FindRoutes(VertexId from, VertexId to, size_t count, size_t max_routes, OnRoute on_route) const;
+
+    private:
+        static constexpr EdgeId NO_EDGE = SIZE_MAX;
+
+        const Graph& graph_;
+
+        struct VertexData {
+            Weight weight;
+            EdgeId prev_edge;
+            uint32_t stamp = 0;
+        };
+
+        using QueueItem = std::pair<Weight, VertexId>;
+
+        // Ordered by weight, then by the order found.
+        struct Candidate {
+            Weight weight;
+            size_t order;
+            std::vector<EdgeId> edges;
+
+            bool operator>(const Candidate& other) const {
+                return std::tie(weight, order) > std::tie(other.weight, other.order);
+            }
+        };
+
+        struct Workspace {
+            std::vector<VertexData> vertices_data;
+            // Vertices of the prefix carry the stamp of the deviation.
+            std::vector<uint32_t> removed_stamps;
+            // Edges that may not leave the deviation vertex.
+            std::vector<EdgeId> removed_edges;
+            std::vector<QueueItem> queue;
+            std::vector<EdgeId> edges;
+            uint32_t current_stamp = 0;
+
+            explicit Workspace(size_t vertex_count) : vertices_data(vertex_count), removed_stamps(vertex_count, 0) {}
+
+            void Reset() {
+                queue.clear();
+                if (++current_stamp == 0) {
+                    for (auto& vertex_data : vertices_data) {
+                        vertex_data.stamp = 0;
+                    }
+                    std::fill(removed_stamps.begin(), removed_stamps.end(), 0);
+                    current_stamp = 1;
+                }
+            }
+        };
+
+        WorkspacePool<Workspace> workspaces_;
+
+        // Shortest route from from to to that avoids the removed vertices and
+        // the removed edges out of from; its edges go to workspace.edges.
+        bool FindDeviation(Workspace& workspace, VertexId from, VertexId to, Weight& weight) const;
+    };
+
+
+    template <typename Weight>
+    YenRouter<Weight>::YenRouter(const Graph& graph)
+        : graph_(graph),
+        workspaces_(graph.GetVertexCount())
+    {
+    }
+
+    template <typename Weight>
+    bool YenRouter<Weight>::FindDeviation(Workspace& workspace, VertexId from, VertexId to, Weight& weight) const {
+        auto& vertices_data = workspace.vertices_data;
+        auto& queue = workspace.queue;
+        const uint32_t current_stamp = workspace.current_stamp;
+        vertices_data[from] = {0, NO_EDGE, current_stamp};
+        queue.push_back({0, from});
+
+        while (!queue.empty()) {
+            std::pop_heap(queue.begin(), queue.end(), std::greater<QueueItem>());
+            const auto [vertex_weight, vertex] = queue.back();
+            queue.pop_back();
+            if (vertices_data[vertex].weight < vertex_weight) {
+                continue;
+            }
+            if (vertex == to) {
+                break;
+            }
+            for (const EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+                const VertexId edge_to = graph_.GetEdgeTo(edge_id);
+                if (workspace.removed_stamps[edge_to] == current_stamp) {
+                    continue;
+                }
+                if (vertex == from && std::find(workspace.removed_edges.begin(), workspace.removed_edges.end(), edge_id)
+                        != workspace.removed_edges.end()) {
+                    continue;
+                }
+                assert(graph_.GetEdgeWeight(edge_id) >= 0);
+                auto& vertex_data = vertices_data[edge_to];
+                const Weight candidate_weight = vertex_weight + graph_.GetEdgeWeight(edge_id);
+                if (vertex_data.stamp != current_stamp || candidate_weight < vertex_data.weight) {
+                    vertex_data = {candidate_weight, edge_id, current_stamp};
+                    queue.push_back({candidate_weight, edge_to});
+                    std::push_heap(queue.begin(), queue.end(), std::greater<QueueItem>());
+                }
+            }
+        }
+
+        if (vertices_data[to].stamp != current_stamp) {
+            return false;
+        }
+        weight = vertices_data[to].weight;
+        workspace.edges.clear();
+        for (EdgeId edge_id = vertices_data[to].prev_edge; edge_id != NO_EDGE;
+                edge_id = vertices_data[graph_.GetEdgeFrom(edge_id)].prev_edge) {
+            workspace.edges.push_back(edge_id);
+        }
+        std::reverse(workspace.edges.begin(), workspace.edges.end());
+        return true;
+    }
+
+    template <typename Weight>
+    template <typename OnRoute>
+    void YenRouter<Weight>::FindRoutes(VertexId from, VertexId to, size_t count, size_t max_routes, OnRoute on_route) const {
+        if (count == 0) {
+            return;
+        }
+        const auto workspace = workspaces_.Acquire();
+        std::vector<Route> found;
+        // Min-heap of deviations not taken yet.
+        std::vector<Candidate> candidates;
+        // Edges of every candidate so far, taken or not.
+        std::set<std::vector<EdgeId>> candidate_edges;
+        size_t accepted_count = 0;
+
+        workspace->Reset();
+        workspace->removed_edges.clear();
+        Weight weight;
+        if (!FindDeviation(*workspace, from, to, weight)) {
+            return;
+        }
+        candidates.push_back({weight, 0, workspace->edges});
+        candidate_edges.insert(workspace->edges);
+
+        while (!candidates.empty() && found.size() < max_routes) {
+            std::pop_heap(candidates.begin(), candidates.end(), std::greater<Candidate>());
+            found.push_back({candidates.back().weight, std::move(candidates.back().edges)});
+            candidates.pop_back();
+            const Route& last = found.back();
+            if (on_route(last.edges) && ++accepted_count == count) {
+                break;
+            }
+
+            Weight prefix_weight = 0;
+            VertexId vertex = from;
+            for (size_t position = 0; position < last.edges.size(); ++position) {
+                workspace->Reset();
+                workspace->removed_edges.clear();
+                for (const Route& route : found) {
+                    if (route.edges.size() > position
+                            && std::equal(last.edges.begin(), last.edges.begin() + position, route.edges.begin())) {
+                        workspace->removed_edges.push_back(route.edges[position]);
+                    }
+                }
+                for (size_t prefix_position = 0; prefix_position < position; ++prefix_position) {
+                    workspace->removed_stamps[graph_.GetEdgeFrom(last.edges[prefix_position])] = workspace->current_stamp;
+                }
+                if (FindDeviation(*workspace, vertex, to, weight)) {
+                    std::vector<EdgeId> edges;
+                    edges.reserve(position + workspace->edges.size());
+                    edges.assign(last.edges.begin(), last.edges.begin() + position);
+                    edges.insert(edges.end(), workspace->edges.begin(), workspace->edges.end());
+                    if (candidate_edges.insert(edges).second) {
+                        candidates.push_back({prefix_weight + weight, candidate_edges.size(), std::move(edges)});
+                        std::push_heap(candidates.begin(), candidates.end(), std::greater<Candidate>());
+                    }
+                }
+                prefix_weight += graph_.GetEdgeWeight(last.edges[position]);
+                vertex = graph_.GetEdgeTo(last.edges[position]);
+            }
+        }
+    }
+
+}